@@ -3,9 +3,7 @@ import os
 import sys
 import subprocess
 import tempfile
-import difflib
-from bisect import bisect_right
-from typing import Dict, Any, List, Optional
+from typing import Dict, Any, Iterator, List, Optional, Tuple
 
 
 CURRENT_DIR = os.path.dirname(__file__)
@@ -14,6 +12,80 @@ if CURRENT_DIR not in sys.path:
 
 BIN_DIR = os.path.join(CURRENT_DIR, "bin")
 CPP_BIN = os.path.join(BIN_DIR, "cpp_checker.exe" if os.name == "nt" else "cpp_checker")
+# CPP_CHECKER_CACHE_DIR=DIR keeps finished results on disk so repeat checks of the same pair skip the
+# comparison (off by default). The directory holds the checked text, so the binary keeps it private
+# to the owner; CPP_CHECKER_CACHE_DIR_BYTES bounds its size (default 256 MB)
+CPP_CACHE_DIR = os.environ.get("CPP_CHECKER_CACHE_DIR", "")
+# Time budget per comparison; a pair that runs out is answered with a partial result flagged "truncated"
+CPP_TIMEOUT_MS = int(os.environ.get("CPP_CHECKER_TIMEOUT_MS", "30000"))
+# Memory caps per comparison: k-grams more frequent than this in a document are not extended, and
+# at most this many spans are kept; hits are reported under "limits"
+CPP_MAX_OCCURRENCES = int(os.environ.get("CPP_CHECKER_MAX_OCCURRENCES", "10000"))
+CPP_MAX_SPANS = int(os.environ.get("CPP_CHECKER_MAX_SPANS", "20000"))
+CPP_LIMIT_ARGS = ["--timeout-ms", str(CPP_TIMEOUT_MS), "--max-occurrences", str(CPP_MAX_OCCURRENCES), "--max-spans", str(CPP_MAX_SPANS)]
+# CPP_CHECKER_MAX_EDITS=N lets a span extend through up to N typos or small edits, so a lightly
+# edited paragraph comes back as one span with its "edits" count (off by default)
+CPP_MAX_EDITS = int(os.environ.get("CPP_CHECKER_MAX_EDITS", "0"))
+if CPP_MAX_EDITS > 0:
+	CPP_LIMIT_ARGS += ["--max-edits", str(CPP_MAX_EDITS)]
+# CPP_CHECKER_STATS=1 profiles every check (phase timings, work counters, peak memory) and returns
+# the profile under "stats"; profiled checks bypass the result cache
+if os.environ.get("CPP_CHECKER_STATS", "") not in ("", "0"):
+	CPP_LIMIT_ARGS.append("--stats")
+# CPP_CHECKER_MODE=word fingerprints word n-grams instead of character windows; =code fingerprints
+# normalised source-code tokens, so renamed identifiers still match (see --mode)
+if os.environ.get("CPP_CHECKER_MODE", ""):
+	CPP_LIMIT_ARGS += ["--mode", os.environ["CPP_CHECKER_MODE"]]
+# The checker sees temporary .txt files, so code submissions name their comment syntax with
+# CPP_CHECKER_LANG=c (C, C++, Java) or =python; without it the code mode lexes C-style comments
+if os.environ.get("CPP_CHECKER_LANG", ""):
+	CPP_LIMIT_ARGS += ["--lang", os.environ["CPP_CHECKER_LANG"]]
+
+
+def _cache_args() -> List[str]:
+	if not CPP_CACHE_DIR:
+		return []
+	args = ["--cache-dir", CPP_CACHE_DIR]
+	if os.environ.get("CPP_CHECKER_CACHE_DIR_BYTES", ""):
+		args += ["--cache-dir-bytes", os.environ["CPP_CHECKER_CACHE_DIR_BYTES"]]
+	return args
+
+
+# Options are only passed to a binary that lists them under --capabilities. An older binary, such as
+# a bin/cpp_checker.exe not rebuilt since, gets the bare "<fileA> <fileB>" call it understands.
+_FLAG_VALUES = {"--stats": 0}
+_capabilities: Dict[Tuple[str, float], frozenset] = {}
+
+
+def _binary_capabilities() -> frozenset:
+	"""Features the checker binary reports; empty for a binary that predates --capabilities"""
+	try:
+		key = (CPP_BIN, os.path.getmtime(CPP_BIN))
+	except OSError:
+		return frozenset()
+	if key not in _capabilities:
+		features: frozenset = frozenset()
+		try:
+			proc = subprocess.run([CPP_BIN, "--capabilities"], capture_output=True, text=True, timeout=10, check=False)
+			if proc.returncode == 0:
+				features = frozenset(json.loads(proc.stdout).get("features", []))
+		except (OSError, subprocess.SubprocessError, ValueError, AttributeError):
+			pass
+		_capabilities[key] = features
+	return _capabilities[key]
+
+
+def _checker_args(features: frozenset) -> List[str]:
+	"""Cache and limit options, without those the binary does not support"""
+	args = [*_cache_args(), *CPP_LIMIT_ARGS]
+	supported: List[str] = []
+	i = 0
+	while i < len(args):
+		n = 1 + _FLAG_VALUES.get(args[i], 1)
+		if args[i][2:] in features:
+			supported += args[i:i + n]
+		i += n
+	return supported
 
 
 def _run_cpp_checker(text_a: str, text_b: str) -> Dict[str, Any]:
@@ -29,7 +101,7 @@ def _run_cpp_checker(text_a: str, text_b: str) -> Dict[str, Any]:
 	try:
 		if not os.path.exists(CPP_BIN):
 			return {"localScore": 0.0, "error": f"C++ binary not found at {CPP_BIN}"}
-		proc = subprocess.run([CPP_BIN, path_a, path_b], capture_output=True, text=True, check=False)
+		proc = subprocess.run([CPP_BIN, *_checker_args(_binary_capabilities()), path_a, path_b], capture_output=True, text=True, check=False)
 		stdout = proc.stdout.strip()
 		# Expected output: {"localScore": <number>, "matches": [...], ...}
 		try:
@@ -45,6 +117,71 @@ def _run_cpp_checker(text_a: str, text_b: str) -> Dict[str, Any]:
 				pass
 
 
+def _stream_cpp_checker_batch(text_a: str, texts_b: List[str]) -> Iterator[Tuple[int, Dict[str, Any]]]:
+	"""Compares text_a with every text in texts_b in one checker run, yielding (index, result) as each
+	comparison finishes; text_a is preprocessed once"""
+	features = _binary_capabilities()
+	if os.path.exists(CPP_BIN) and not {"stream", "manifest"} <= features:
+		# A binary without the streaming manifest mode runs once per pair
+		for i, text_b in enumerate(texts_b):
+			yield i, _run_cpp_checker(text_a, text_b)
+		return
+	paths: List[str] = []
+	try:
+		for i, text in enumerate([text_a] + texts_b):
+			with tempfile.NamedTemporaryFile(delete=False, suffix=f"_{i}.txt", mode="w", encoding="utf-8") as f:
+				f.write(text)
+				paths.append(f.name)
+		if not os.path.exists(CPP_BIN):
+			for i in range(len(texts_b)):
+				yield i, {"localScore": 0.0, "error": f"C++ binary not found at {CPP_BIN}"}
+			return
+		# Manifest: the query on its own line, then one "<TAB>target" line per comparison
+		manifest = paths[0] + "\n" + "".join("\t" + p + "\n" for p in paths[1:])
+		proc = subprocess.Popen([CPP_BIN, *_checker_args(features), "--stream", "--manifest", "-"],
+			stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True, encoding="utf-8")
+		pending = set(range(len(texts_b)))
+		try:
+			proc.stdin.write(manifest)
+			proc.stdin.close()
+			# One NDJSON record per finished pair, then a closing "done" record
+			for line in proc.stdout:
+				try:
+					record = json.loads(line)
+				except json.JSONDecodeError:
+					continue
+				if record.get("done") or record.get("pair") not in pending:
+					continue
+				pending.discard(record["pair"])
+				yield record["pair"], record
+		finally:
+			proc.stdout.close()
+			proc.wait()
+		for i in sorted(pending):
+			yield i, {"localScore": 0.0, "error": "C++ checker returned no result"}
+	finally:
+		for p in paths:
+			try:
+				os.remove(p)
+			except OSError:
+				pass
+
+
+def _read_checked_file(path: Optional[str], unsupported_formats: List[str]) -> str:
+    allowed_extensions = {".txt"}
+    if not path or not os.path.exists(path):
+        return ""
+    ext = os.path.splitext(path)[1].lower()
+    if ext and ext not in allowed_extensions:
+        unsupported_formats.append(ext)
+        return ""
+    try:
+        with open(path, "r", encoding="utf-8", errors="ignore") as f:
+            return f.read()
+    except Exception:
+        return ""
+
+
 def run_checks(*, file_a_path: str, file_b_path: str, text_b: str, mode: str) -> Dict[str, Any]:
     """
     Compare two files using local comparison and return structured highlights.
@@ -53,24 +190,9 @@ def run_checks(*, file_a_path: str, file_b_path: str, text_b: str, mode: str) ->
     if mode != "local":
         return {"error": "Only local mode is supported"}
 
-    allowed_extensions = {".txt"}
     unsupported_formats: List[str] = []
-
-    def read_file_text(path: Optional[str]) -> str:
-        if not path or not os.path.exists(path):
-            return ""
-        ext = os.path.splitext(path)[1].lower()
-        if ext and ext not in allowed_extensions:
-            unsupported_formats.append(ext)
-            return ""
-        try:
-            with open(path, "r", encoding="utf-8", errors="ignore") as f:
-                return f.read()
-        except Exception:
-            return ""
-
-    text_a = read_file_text(file_a_path)
-    text_b_val = read_file_text(file_b_path)
+    text_a = _read_checked_file(file_a_path, unsupported_formats)
+    text_b_val = _read_checked_file(file_b_path, unsupported_formats)
     if not text_b_val:
         text_b_val = text_b or ""
 
@@ -88,551 +210,175 @@ def run_checks(*, file_a_path: str, file_b_path: str, text_b: str, mode: str) ->
     except Exception as e:
         return {"error": f"Check failed: {str(e)}"}
 
-    # Use only local score
-    overall = float(cpp_result.get("localScore", 0.0))
+    file_a_name = os.path.basename(file_a_path) if file_a_path else "fileA"
+    file_b_name = os.path.basename(file_b_path) if file_b_path else "fileB"
+    return _format_result(cpp_result, text_a, text_b_val, file_a_name, file_b_name)
 
-    # Process local matches only, merging contiguous spans for clarity
-    raw_matches: List[Dict[str, Any]] = list(cpp_result.get("matches", []) or [])
-
-    # Fallback: if C++ binary returns tiny windowed matches, extend them using Python
-    def _preprocess_with_map(s: str) -> tuple[str, List[int]]:
-        out = []
-        idx_map: List[int] = []
-        last_space = False
-        for i, ch in enumerate(s):
-            if ch == "\n":
-                out.append("\n")
-                idx_map.append(i)
-                last_space = False
-            elif ch.isspace():
-                if not last_space:
-                    out.append(" ")
-                    idx_map.append(i)
-                    last_space = True
-            else:
-                out.append(ch.lower())
+
+def iter_checks_batch(*, file_a_path: str, file_b_paths: List[str], mode: str) -> Iterator[Dict[str, Any]]:
+    """
+    Compare one file against several in a single checker run, yielding each result as soon as the
+    checker finishes it. Results arrive in completion order; "pair" is the index into file_b_paths.
+    """
+    if mode != "local":
+        yield {"error": "Only local mode is supported"}
+        return
+
+    unsupported_formats: List[str] = []
+    text_a = _read_checked_file(file_a_path, unsupported_formats)
+    texts_b = [_read_checked_file(p, unsupported_formats) for p in file_b_paths]
+
+    if unsupported_formats:
+        yield {"error": "Only .txt files are currently supported"}
+        return
+
+    if not text_a or not texts_b or not all(texts_b):
+        yield {"error": "Both files are required for comparison"}
+        return
+
+    file_a_name = os.path.basename(file_a_path)
+    try:
+        for i, cpp_result in _stream_cpp_checker_batch(text_a, texts_b):
+            result = _format_result(cpp_result, text_a, texts_b[i], file_a_name, os.path.basename(file_b_paths[i]))
+            result["pair"] = i
+            yield result
+    except Exception as e:
+        yield {"error": f"Check failed: {str(e)}"}
+
+
+def run_checks_batch(*, file_a_path: str, file_b_paths: List[str], mode: str) -> Dict[str, Any]:
+    """
+    Compare one file against several in a single checker run; results follow file_b_paths order.
+    """
+    results: List[Dict[str, Any]] = []
+    for result in iter_checks_batch(file_a_path=file_a_path, file_b_paths=file_b_paths, mode=mode):
+        if "pair" not in result:
+            return result
+        results.append(result)
+    results.sort(key=lambda r: r.pop("pair"))
+    return {"results": results}
+
+
+def _processed_index_map(s: str) -> List[int]:
+    """Raw index of every processed-text character, preprocessing like the C++ Document"""
+    idx_map: List[int] = []
+    last_space = False
+    for i, ch in enumerate(s):
+        if ch == "\n":
+            idx_map.append(i)
+            last_space = False
+        elif ch.isspace():
+            if not last_space:
                 idx_map.append(i)
-                last_space = False
-        return ("".join(out), idx_map)
-
-    def _extend_span_list(spans: List[Dict[str, Any]]) -> List[Dict[str, Any]]:
-        procA, mapA = _preprocess_with_map(text_a)
-        procB, mapB = _preprocess_with_map(text_b_val)
-        extended: List[Dict[str, Any]] = []
-        last_end_b = -1
-        for m in sorted(spans, key=lambda x: int(x.get("startB", 0))):
-            sa = int(m.get("startA", 0))
-            sb = int(m.get("startB", 0))
-            ea = int(m.get("endA", 0))
-            eb = int(m.get("endB", 0))
-            # Backward extend
-            while sa > 0 and sb > 0 and procA[sa - 1] == procB[sb - 1]:
-                sa -= 1
-                sb -= 1
-            # Forward extend
-            while ea < len(procA) and eb < len(procB) and procA[ea] == procB[eb]:
-                ea += 1
-                eb += 1
-            # Deduplicate overlapping on B
-            if last_end_b >= 0 and sb <= last_end_b:
-                if extended and eb > int(extended[-1].get("endB", 0)):
-                    extended[-1]["endA"] = ea
-                    extended[-1]["endB"] = eb
-                    # update raw slices/text using maps
-                    raw_start_a = mapA[extended[-1]["startA"]]
-                    raw_end_a = mapA[min(extended[-1]["endA"] - 1, len(mapA) - 1)] + 1
-                    raw_start_b = mapB[extended[-1]["startB"]]
-                    raw_end_b = mapB[min(extended[-1]["endB"] - 1, len(mapB) - 1)] + 1
-                    extended[-1]["rawStartA"] = raw_start_a
-                    extended[-1]["rawEndA"] = raw_end_a
-                    extended[-1]["rawStartB"] = raw_start_b
-                    extended[-1]["rawEndB"] = raw_end_b
-                    extended[-1]["textA"] = text_a[raw_start_a:raw_end_a]
-                    extended[-1]["textB"] = text_b_val[raw_start_b:raw_end_b]
-                continue
-            # map to raw indices
-            raw_start_a = mapA[sa]
-            raw_end_a = mapA[min(ea - 1, len(mapA) - 1)] + 1
-            raw_start_b = mapB[sb]
-            raw_end_b = mapB[min(eb - 1, len(mapB) - 1)] + 1
-            extended.append({
-                "startA": sa, "endA": ea, "startB": sb, "endB": eb,
-                "textA": text_a[raw_start_a:raw_end_a],
-                "textB": text_b_val[raw_start_b:raw_end_b],
-                "rawStartA": raw_start_a,
-                "rawEndA": raw_end_a,
-                "rawStartB": raw_start_b,
-                "rawEndB": raw_end_b,
-                "lineA": int(m.get("lineA", 0)),
-                "lineB": int(m.get("lineB", 0)),
-            })
-            last_end_b = max(last_end_b, eb)
-        return extended
-
-    if raw_matches:
-        raw_matches = _extend_span_list(raw_matches)
-
-    def merge_spans(spans: List[Dict[str, Any]]) -> List[Dict[str, Any]]:
-        spans = sorted(spans, key=lambda x: (int(x.get("lineB", 0)), int(x.get("startB", 0))))
-        merged: List[Dict[str, Any]] = []
-        for m in spans:
-            if not merged:
-                merged.append(dict(m))
-                continue
-            prev = merged[-1]
-            same_lines = int(prev.get("lineA", -1)) == int(m.get("lineA", -2)) and int(prev.get("lineB", -1)) == int(m.get("lineB", -2))
-            close = int(m.get("startB", 0)) <= int(prev.get("endB", 0)) + 4 and int(m.get("startA", 0)) <= int(prev.get("endA", 0)) + 4
-            if same_lines and close:
-                prev["endB"] = max(int(prev.get("endB", 0)), int(m.get("endB", 0)))
-                prev["endA"] = max(int(prev.get("endA", 0)), int(m.get("endA", 0)))
-                prev["rawStartA"] = min(int(prev.get("rawStartA", prev["startA"])), int(m.get("rawStartA", m.get("startA", prev["startA"]))))
-                prev["rawEndA"] = max(int(prev.get("rawEndA", prev["endA"])), int(m.get("rawEndA", m.get("endA", prev["endA"]))))
-                prev["rawStartB"] = min(int(prev.get("rawStartB", prev["startB"])), int(m.get("rawStartB", m.get("startB", prev["startB"]))))
-                prev["rawEndB"] = max(int(prev.get("rawEndB", prev["endB"])), int(m.get("rawEndB", m.get("endB", prev["endB"]))))
-            else:
-                merged.append(dict(m))
-        return merged
-
-    merged_matches = merge_spans(raw_matches)
-
-    def _compute_line_offsets(text: str) -> List[int]:
-        offsets: List[int] = []
-        pos = 0
-        for line in text.splitlines(True):  # keep newline lengths
-            offsets.append(pos)
-            pos += len(line)
-        if not offsets:
-            offsets.append(0)
-        return offsets
-
-    def _compute_sentence_offsets(text: str, max_segment_len: int = 300) -> List[int]:
-        # Build virtual line offsets by splitting on sentence boundaries and hard length caps
-        offsets: List[int] = [0]
-        last = 0
-        i = 0
-        n = len(text)
-        while i < n:
-            # sentence boundary heuristic: end at ., !, ? followed by whitespace
-            if text[i] in ".!?":
-                # advance past trailing whitespace
-                j = i + 1
-                while j < n and text[j].isspace() and text[j] not in "\n\r":
-                    j += 1
-                if j - last >= 1:
-                    offsets.append(j)
-                    last = j
-                i = j
-                continue
-            # hard cap to avoid huge segments
-            if (i - last) >= max_segment_len:
-                offsets.append(i)
-                last = i
-            i += 1
-        # ensure final boundary at end
-        if offsets[-1] != n:
-            offsets.append(n)
-        # unique and sorted starts only
-        starts = sorted(set(offsets[:-1]))
-        return starts if starts else [0]
-
-    # Real line offsets based on actual newlines (used for both matching and display)
-    real_line_offsets_a = _compute_line_offsets(text_a)
-    real_line_offsets_b = _compute_line_offsets(text_b_val)
-    line_offsets_a = real_line_offsets_a
-    line_offsets_b = real_line_offsets_b
+                last_space = True
+        else:
+            idx_map.append(i)
+            last_space = False
+    return idx_map
+
+
+def _legacy_highlights(matches: List[Dict[str, Any]], text_a: str, text_b: str) -> List[Dict[str, Any]]:
+    """Highlights in the native shape for a binary that predates them: its processed-text matches
+    are merged where they overlap in B and mapped back to raw offsets"""
+    map_a = _processed_index_map(text_a)
+    map_b = _processed_index_map(text_b)
+    ranges: List[List[int]] = []
+    for m in sorted(matches, key=lambda x: (int(x.get("startB", 0)), int(x.get("startA", 0)))):
+        sa, ea, sb, eb = (int(m.get(k, 0)) for k in ("startA", "endA", "startB", "endB"))
+        if not (0 <= sa < ea <= len(map_a) and 0 <= sb < eb <= len(map_b)):
+            continue
+        if ranges and sb <= ranges[-1][3]:
+            last = ranges[-1]
+            last[0], last[1], last[3] = min(last[0], sa), max(last[1], ea), max(last[3], eb)
+            continue
+        ranges.append([sa, ea, sb, eb])
+
+    def position(text: str, pos: int, suffix: str) -> Dict[str, int]:
+        line_start = text.rfind("\n", 0, pos) + 1
+        return {"line" + suffix: text.count("\n", 0, pos) + 1, "column" + suffix: pos - line_start + 1,
+                "sentence" + suffix: 1 + sum(text.count(p, 0, pos) for p in (". ", "! ", "? "))}
+
+    highlights: List[Dict[str, Any]] = []
+    for sa, ea, sb, eb in ranges:
+        ra0, ra1 = map_a[sa], map_a[ea - 1] + 1
+        rb0, rb1 = map_b[sb], map_b[eb - 1] + 1
+        a_pos, b_pos = position(text_a, ra0, "A"), position(text_b, rb0, "B")
+        highlights.append({
+            "rawStartA": ra0, "rawEndA": ra1, "rawStartB": rb0, "rawEndB": rb1,
+            "lineStartA": a_pos["lineA"], "lineEndA": text_a.count("\n", 0, ra1 - 1) + 1,
+            "lineStartB": b_pos["lineB"], "lineEndB": text_b.count("\n", 0, rb1 - 1) + 1,
+            **a_pos, **b_pos,
+            "textA": text_a[ra0:ra1], "textB": text_b[rb0:rb1],
+            "matchType": "partial",
+        })
+    return highlights
+
+
+def _format_result(cpp_result: Dict[str, Any], text_a: str, text_b_val: str, file_a_name: str, file_b_name: str) -> Dict[str, Any]:
+    # Use only local score
+    overall = float(cpp_result.get("localScore", 0.0))
 
+    # The C++ checker refines spans, aligns paragraphs, matches sentences and deduplicates the
+    # result; highlights are forwarded with the service's field names
     local_highlights: List[Dict[str, Any]] = []
-    file_a_name = os.path.basename(file_a_path) if file_a_path else "fileA"
-    file_b_name = os.path.basename(file_b_path) if file_b_path else "fileB"
-
-    def _line_number(offsets: List[int], pos: int) -> int:
-        if not offsets:
-            return 0
-        if pos < 0:
-            pos = 0
-        idx = bisect_right(offsets, pos) - 1
-        if idx < 0:
-            idx = 0
-        if idx >= len(offsets):
-            idx = len(offsets) - 1
-        return idx + 1
-
-    def _line_meta(text: str, offsets: List[int], span_start: int, span_end: int) -> tuple[int, str]:
-        if not offsets:
-            return 0, ""
-        if span_start < 0:
-            span_start = 0
-        if span_end <= span_start:
-            span_end = min(len(text), span_start + 1)
-        scan_limit = min(len(text), max(span_end, span_start + 1))
-        pos = max(0, min(span_start, len(text) - 1))
-        while pos < scan_limit and pos < len(text) and text[pos] in ("\r", "\n"):
-            pos += 1
-        if pos >= len(text):
-            pos = len(text) - 1
-        idx = bisect_right(offsets, pos) - 1
-        if idx < 0:
-            idx = 0
-        if idx >= len(offsets):
-            idx = len(offsets) - 1
-        line_no = idx + 1
-        line_start = offsets[idx]
-        line_end = offsets[idx + 1] if idx + 1 < len(offsets) else len(text)
-        line_text = text[line_start:line_end].rstrip("\r\n")
-        return line_no, line_text
-
-    for m in merged_matches:
+    if "highlights" in cpp_result:
+        native_highlights = cpp_result.get("highlights") or []
+    else:
+        native_highlights = _legacy_highlights(list(cpp_result.get("matches", []) or []), text_a, text_b_val)
+    for h in native_highlights:
         try:
-            startB = int(m.get("startB", 0))
-            endB = int(m.get("endB", 0))
-            startA = int(m.get("startA", 0)) if "startA" in m else 0
-            endA = int(m.get("endA", 0)) if "endA" in m else 0
-            raw_startA = int(m.get("rawStartA", startA))
-            raw_endA = int(m.get("rawEndA", endA))
-            raw_startB = int(m.get("rawStartB", startB))
-            raw_endB = int(m.get("rawEndB", endB))
-
-            # Refine using line-level longest matching block
-            refined_startA = raw_startA
-            refined_endA = raw_endA
-            refined_startB = raw_startB
-            refined_endB = raw_endB
-            # Use real line offsets for display
-            lineA, src_line_text = _line_meta(text_a, real_line_offsets_a, refined_startA, refined_endA)
-            lineB, tgt_line_text = _line_meta(text_b_val, real_line_offsets_b, refined_startB, refined_endB)
-            lineStartA = _line_number(real_line_offsets_a, refined_startA)
-            lineEndA = _line_number(real_line_offsets_a, max(refined_endA - 1, refined_startA))
-            lineStartB = _line_number(real_line_offsets_b, refined_startB)
-            lineEndB = _line_number(real_line_offsets_b, max(refined_endB - 1, refined_startB))
-
-            single_line_match = (
-                src_line_text
-                and tgt_line_text
-                and lineStartA == lineEndA
-                and lineStartB == lineEndB
-                and lineStartA > 0
-                and lineStartB > 0
-            )
-            if single_line_match:
-                sm = difflib.SequenceMatcher(None, src_line_text, tgt_line_text)
-                blocks = sm.get_matching_blocks()
-                # choose the longest block with >= 6 chars
-                best = max(blocks, key=lambda b: b.size) if blocks else None
-                if best and best.size >= 6:
-                    # map to global positions
-                    offA = line_offsets_a[lineA - 1]
-                    offB = line_offsets_b[lineB - 1]
-                    refined_startA = offA + best.a
-                    refined_endA = offA + best.a + best.size
-                    refined_startB = offB + best.b
-                    refined_endB = offB + best.b + best.size
-
-            # drop low-quality overlaps
-            if refined_endB - refined_startB < 6:
-                continue
-            try:
-                sm2 = difflib.SequenceMatcher(None, text_a[refined_startA:refined_endA], text_b_val[refined_startB:refined_endB])
-                if sm2.ratio() < 0.5:
-                    continue
-            except Exception:
-                pass
-
-            if refined_endA <= refined_startA and raw_endA > raw_startA:
-                refined_startA, refined_endA = raw_startA, raw_endA
-            if refined_endB <= refined_startB and raw_endB > raw_startB:
-                refined_startB, refined_endB = raw_startB, raw_endB
-
-            local_highlights.append({
-                "start": refined_startB,
-                "end": refined_endB,
+            item: Dict[str, Any] = {
+                "start": int(h["rawStartB"]),
+                "end": int(h["rawEndB"]),
                 "source": "local",
                 "score": cpp_result.get("localScore", 0.0),
-                "textA": text_a[refined_startA:refined_endA],
-                "textB": text_b_val[refined_startB:refined_endB],
-                "lineA": lineA,
-                "lineB": lineB,
-                "lineStartA": lineStartA,
-                "lineEndA": lineEndA,
-                "lineStartB": lineStartB,
-                "lineEndB": lineEndB,
-                "charStartA": refined_startA,
-                "charEndA": refined_endA,
-                "charStartB": refined_startB,
-                "charEndB": refined_endB,
-                "lineTextA": src_line_text,
-                "lineTextB": tgt_line_text,
-                "matchType": "exact" if overall == 100.0 else "partial",
-                "sourceFile": file_a_name,
-                "targetFile": file_b_name,
-            })
-        except Exception:
-            pass
-
-    def _paragraph_spans(text: str) -> List[Dict[str, int]]:
-        spans: List[Dict[str, int]] = []
-        pos = 0
-        start = 0
-        gap = False
-        for line in text.splitlines(True):
-            if line.strip() == "":
-                if not gap:
-                    gap = True
-            else:
-                if gap and pos > start:
-                    spans.append({"start": start, "end": pos})
-                    start = pos
-                gap = False
-            pos += len(line)
-        if pos > start:
-            spans.append({"start": start, "end": pos})
-        return spans
-
-    para_a = _paragraph_spans(text_a)
-    para_b = _paragraph_spans(text_b_val)
-
-    def _overlaps(a1: int, a2: int, b1: int, b2: int) -> bool:
-        return not (a2 <= b1 or a1 >= b2)
-
-    for pa in para_a:
-        sa = pa["start"]
-        ea = pa["end"]
-        ta = text_a[sa:ea]
-        merged_eq_segments: List[tuple[int,int,int,int]] = []
-        def _is_noise_gap(seg: str) -> bool:
-            if not seg:
-                return True
-            return all(not ch.isalnum() for ch in seg)
-        for pb in para_b:
-            sb = pb["start"]
-            eb = pb["end"]
-            tb = text_b_val[sb:eb]
-            if not ta.strip() or not tb.strip():
-                continue
-            smp = difflib.SequenceMatcher(None, ta, tb)
-            for tag, a0, a1, b0, b1 in smp.get_opcodes():
-                if tag != 'equal':
-                    continue
-                size = a1 - a0
-                if size < 20:
-                    continue
-                rsa = sa + a0
-                rea = sa + a1
-                rsb = sb + b0
-                reb = sb + b1
-                if merged_eq_segments:
-                    lsA0, lsA1, lsB0, lsB1 = merged_eq_segments[-1]
-                    gapA = rsa - lsA1
-                    gapB = rsb - lsB1
-                    gapAtext = text_a[lsA1:rsa]
-                    gapBtext = text_b_val[lsB1:rsb]
-                    if gapA <= 10 and gapB <= 10 and _is_noise_gap(gapAtext) and _is_noise_gap(gapBtext):
-                        # merge into last
-                        merged_eq_segments[-1] = (lsA0, rea, lsB0, reb)
-                    else:
-                        merged_eq_segments.append((rsa, rea, rsb, reb))
-                else:
-                    merged_eq_segments.append((rsa, rea, rsb, reb))
-        for rsa, rea, rsb, reb in merged_eq_segments:
-            if any(_overlaps(rsb, reb, h.get("start", 0), h.get("end", 0)) for h in local_highlights):
-                continue
-            la, lta = _line_meta(text_a, line_offsets_a, rsa, rea)
-            lb, ltb = _line_meta(text_b_val, line_offsets_b, rsb, reb)
-            lsa = _line_number(line_offsets_a, max(rsa - 1, rsa))
-            lea = _line_number(line_offsets_a, max(rea - 1, rsa))
-            lsb = _line_number(line_offsets_b, max(rsb - 1, rsb))
-            leb = _line_number(line_offsets_b, max(reb - 1, rsb))
-            local_highlights.append({
-                "start": rsb,
-                "end": reb,
-                "source": "local",
-                "score": cpp_result.get("localScore", 0.0),
-                "textA": text_a[rsa:rea],
-                "textB": text_b_val[rsb:reb],
-                "lineA": la,
-                "lineB": lb,
-                "lineStartA": lsa,
-                "lineEndA": lea,
-                "lineStartB": lsb,
-                "lineEndB": leb,
-                "charStartA": rsa,
-                "charEndA": rea,
-                "charStartB": rsb,
-                "charEndB": reb,
-                "lineTextA": lta,
-                "lineTextB": ltb,
-                "matchType": "paragraph",
-                "sourceFile": file_a_name,
-                "targetFile": file_b_name,
-            })
-
-    def _overlap_ratio(s1: int, e1: int, s2: int, e2: int) -> float:
-        inter = max(0, min(e1, e2) - max(s1, s2))
-        uni = max(e1, e2) - min(s1, s2)
-        return (inter / uni) if uni > 0 else 0.0
-
-    def _dedup_highlights(items: List[Dict[str, Any]]) -> List[Dict[str, Any]]:
-        items_sorted = sorted(items, key=lambda x: (int(x.get("lineB", 0)), int(x.get("start", 0))))
-        result: List[Dict[str, Any]] = []
-        for h in items_sorted:
-            if not result:
-                result.append(h)
-                continue
-            last = result[-1]
-            rB = _overlap_ratio(int(h.get("start", 0)), int(h.get("end", 0)), int(last.get("start", 0)), int(last.get("end", 0)))
-            rA = _overlap_ratio(int(h.get("charStartA", 0)), int(h.get("charEndA", 0)), int(last.get("charStartA", 0)), int(last.get("charEndA", 0)))
-            same_lines = int(h.get("lineA", 0)) == int(last.get("lineA", -1)) and int(h.get("lineB", 0)) == int(last.get("lineB", -1))
-            if rB >= 0.6 and rA >= 0.4 and same_lines:
-                len_h = (int(h.get("end", 0)) - int(h.get("start", 0))) + (int(h.get("charEndA", 0)) - int(h.get("charStartA", 0)))
-                len_last = (int(last.get("end", 0)) - int(last.get("start", 0))) + (int(last.get("charEndA", 0)) - int(last.get("charStartA", 0)))
-                prio_h = 2 if h.get("matchType") == "paragraph" else 1
-                prio_last = 2 if last.get("matchType") == "paragraph" else 1
-                if prio_h > prio_last or (prio_h == prio_last and len_h > len_last):
-                    result[-1] = h
-                else:
-                    pass
-            else:
-                result.append(h)
-        return result
-
-    local_highlights = _dedup_highlights(local_highlights)
-
-    def _normalize_with_map(s: str) -> tuple[str, List[int]]:
-        out = []
-        idx: List[int] = []
-        last_space = False
-        for i, ch in enumerate(s):
-            if ch in "\r\n":
-                continue
-            if ch.isspace():
-                if not last_space:
-                    out.append(" ")
-                    idx.append(i)
-                    last_space = True
-            else:
-                out.append(ch.lower())
-                idx.append(i)
-                last_space = False
-        text_norm = "".join(out).strip()
-        return text_norm, idx
-
-    def _split_sentences(s: str) -> List[str]:
-        import re
-        parts = re.split(r"(?<=[.!?])\s+", s)
-        return [p.strip() for p in parts if p.strip()]
-
-    sentence_highlights: List[Dict[str, Any]] = []
-
-    linesA: List[tuple[int, int]] = []
-    for idx in range(len(real_line_offsets_a)):
-        start = real_line_offsets_a[idx]
-        end = real_line_offsets_a[idx + 1] if idx + 1 < len(real_line_offsets_a) else len(text_a)
-        linesA.append((start, end))
-
-    linesB: List[tuple[int, int]] = []
-    for idx in range(len(real_line_offsets_b)):
-        start = real_line_offsets_b[idx]
-        end = real_line_offsets_b[idx + 1] if idx + 1 < len(real_line_offsets_b) else len(text_b_val)
-        linesB.append((start, end))
-
-    b_sent_index: Dict[int, List[tuple[str, str]]] = {}
-    for j, (sb, eb) in enumerate(linesB, start=1):
-        raw_line_b = text_b_val[sb:eb]
-        norm_line_b, map_b = _normalize_with_map(raw_line_b)
-        b_sent_index[j] = [(seg, norm_line_b) for seg in _split_sentences(norm_line_b)]
-
-    seen_pairs: set[tuple[int, int, str]] = set()
-    for i, (sa, ea) in enumerate(linesA, start=1):
-        raw_line_a = text_a[sa:ea]
-        norm_line_a, map_a = _normalize_with_map(raw_line_a)
-        a_sents = _split_sentences(norm_line_a)
-        for seg in a_sents:
-            if len(seg) < 8:
-                continue
-            for j, entries in b_sent_index.items():
-                for bseg, _bnorm_full in entries:
-                    if seg == bseg and (i, j, seg) not in seen_pairs:
-                        idx_a = norm_line_a.find(seg)
-                        if idx_a < 0:
-                            continue
-                        raw_line_b_full = text_b_val[linesB[j - 1][0]:linesB[j - 1][1]]
-                        norm_line_b2, map_b2 = _normalize_with_map(raw_line_b_full)
-                        idx_b = norm_line_b2.find(seg)
-                        if idx_b < 0:
-                            continue
-                        start_a_local = map_a[min(idx_a, len(map_a) - 1)]
-                        end_a_local = map_a[min(idx_a + len(seg) - 1, len(map_a) - 1)] + 1
-                        start_b_raw = map_b2[min(idx_b, len(map_b2) - 1)]
-                        end_b_raw = map_b2[min(idx_b + len(seg) - 1, len(map_b2) - 1)] + 1
-                        char_start_a = sa + start_a_local
-                        char_end_a = sa + end_a_local
-                        char_start_b = linesB[j - 1][0] + start_b_raw
-                        char_end_b = linesB[j - 1][0] + end_b_raw
-                        # Compute real line numbers from raw char positions
-                        lineA_real = _line_number(real_line_offsets_a, char_start_a)
-                        lineB_real = _line_number(real_line_offsets_b, char_start_b)
-
-                        sentence_highlights.append({
-                            "start": char_start_b,
-                            "end": char_end_b,
-                            "source": "local",
-                            "score": cpp_result.get("localScore", 0.0),
-                            "textA": text_a[char_start_a:char_end_a],
-                            "textB": text_b_val[char_start_b:char_end_b],
-                            "lineA": lineA_real,
-                            "lineB": lineB_real,
-                            "lineStartA": lineA_real,
-                            "lineEndA": _line_number(real_line_offsets_a, max(char_end_a - 1, char_start_a)),
-                            "lineStartB": lineB_real,
-                            "lineEndB": _line_number(real_line_offsets_b, max(char_end_b - 1, char_start_b)),
-                            "charStartA": char_start_a,
-                            "charEndA": char_end_a,
-                            "charStartB": char_start_b,
-                            "charEndB": char_end_b,
-                            "matchType": "sentence",
-                            "sourceFile": file_a_name,
-                            "targetFile": file_b_name,
-                        })
-                        seen_pairs.add((i, j, seg))
-
-    if sentence_highlights:
-        local_highlights = _dedup_highlights(sentence_highlights)
-
-    # Fallback scoring based on highlight coverage when C++ score is 0
-    def _coverage(intervals: List[tuple[int, int]], total_len: int) -> float:
-        if total_len <= 0 or not intervals:
-            return 0.0
-        intervals = sorted(intervals, key=lambda x: x[0])
-        merged = []
-        cs, ce = intervals[0]
-        for s, e in intervals[1:]:
-            if s <= ce:
-                ce = max(ce, e)
-            else:
-                merged.append((cs, ce))
-                cs, ce = s, e
-        merged.append((cs, ce))
-        covered = sum(e - s for s, e in merged if e > s)
-        return float(covered) * 100.0 / float(total_len)
-
+                "textA": h["textA"],
+                "textB": h["textB"],
+                "lineA": int(h["lineA"]),
+                "lineB": int(h["lineB"]),
+                "lineStartA": int(h["lineStartA"]),
+                "lineEndA": int(h["lineEndA"]),
+                "lineStartB": int(h["lineStartB"]),
+                "lineEndB": int(h["lineEndB"]),
+                "charStartA": int(h["rawStartA"]),
+                "charEndA": int(h["rawEndA"]),
+                "charStartB": int(h["rawStartB"]),
+                "charEndB": int(h["rawEndB"]),
+                "columnA": int(h["columnA"]),
+                "columnB": int(h["columnB"]),
+                "sentenceA": int(h["sentenceA"]),
+                "sentenceB": int(h["sentenceB"]),
+            }
+            if "lineTextA" in h:
+                item["lineTextA"] = h["lineTextA"]
+                item["lineTextB"] = h["lineTextB"]
+            if "edits" in h:
+                item["edits"] = int(h["edits"])
+            item["matchType"] = h["matchType"]
+            item["sourceFile"] = file_a_name
+            item["targetFile"] = file_b_name
+            local_highlights.append(item)
+        except (KeyError, TypeError, ValueError):
+            continue
+
+    # Coverage of both documents by the final highlights comes from the C++ checker; its mean
+    # stands in for the score when the checkers report none
+    coverage_a = float(cpp_result.get("coverageA", 0.0))
+    coverage_b = float(cpp_result.get("coverageB", 0.0))
     local_score = float(cpp_result.get("localScore", 0.0))
     if (local_score == 0.0) and local_highlights:
-        a_intervals = []
-        b_intervals = []
-        for h in local_highlights:
-            try:
-                a_intervals.append((int(h.get("charStartA", h.get("start", 0))), int(h.get("charEndA", h.get("end", 0)))))
-                b_intervals.append((int(h.get("charStartB", h.get("start", 0))), int(h.get("charEndB", h.get("end", 0)))))
-            except Exception:
-                continue
-        a_cov = _coverage(a_intervals, len(text_a))
-        b_cov = _coverage(b_intervals, len(text_b_val))
-        # Use mean coverage as score
-        local_score = (a_cov + b_cov) / 2.0
+        local_score = (coverage_a + coverage_b) / 2.0
         overall = local_score
 
     return {
         "overallScore": overall,
         "localScore": local_score,
+        "coverageA": coverage_a,
+        "coverageB": coverage_b,
+        "containment": float(cpp_result.get("containment", 0.0)),
+        "truncated": bool(cpp_result.get("truncated", False)),
+        "limits": cpp_result.get("limits", {}),
+        **({"stats": cpp_result["stats"]} if "stats" in cpp_result else {}),
         "highlights": local_highlights,
         "localHighlights": local_highlights,
         "mode": "local",
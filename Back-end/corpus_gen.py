@@ -0,0 +1,333 @@
+"""Synthetic plagiarism corpus with ground truth.
+
+	python corpus_gen.py generate OUT [--sources 20] [--suspects 20] [--size 20K] [--copy-ratio 0.4]
+	                                  [--ops verbatim,reorder,substitute,noise] [--negatives 2] [--seed 1]
+	python corpus_gen.py evaluate OUT [--bin PATH] [--threads N] [--mode char|word|code]
+
+generate writes OUT/sources/*.txt, OUT/suspects/*.txt, OUT/truth.jsonl (one record per copied
+passage, with character offsets on both sides) and OUT/manifest.tsv (each suspect against its true
+sources plus --negatives unrelated ones, in cpp_checker --manifest format, paths relative to OUT).
+evaluate runs the C++ checker over the manifest and scores the highlights against the truth at
+character level, overall and per copy operation, together with throughput.
+"""
+import argparse
+import bisect
+import json
+import os
+import random
+import subprocess
+import sys
+import time
+from typing import Dict, Any, List, Tuple
+
+
+OPS = ("verbatim", "reorder", "substitute", "noise")
+# Words replaced by a substitute passage, and the share of a noise passage's words touched
+SUBSTITUTE_RATE = 0.15
+NOISE_RATE = 0.2
+# A truth span counts as detected when at least this share of it is highlighted
+DETECTED_SHARE = 0.5
+
+
+def _parse_size(text: str) -> int:
+	units = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+	text = text.strip().upper()
+	if text and text[-1] in units:
+		return int(float(text[:-1]) * units[text[-1]])
+	return int(text)
+
+
+class TextModel:
+	"""Pseudo-words from a syllable inventory, drawn with a Zipf-like distribution so common words
+	repeat the way they do in prose"""
+
+	def __init__(self, rng: random.Random, vocabulary: int = 6000):
+		onsets = ["", "b", "c", "d", "f", "g", "h", "l", "m", "n", "p", "r", "s", "t", "v", "w", "br", "ch", "cl", "st", "th", "tr"]
+		vowels = ["a", "e", "i", "o", "u", "ea", "ou", "ai"]
+		codas = ["", "", "n", "r", "s", "t", "l", "nd", "st", "ck"]
+		words = set()
+		while len(words) < vocabulary:
+			syllables = 1 + min(rng.randrange(4), rng.randrange(4))
+			words.add("".join(rng.choice(onsets) + rng.choice(vowels) + rng.choice(codas) for _ in range(syllables)))
+		self.words = sorted(words, key=lambda w: (len(w), w))
+		total = 0.0
+		self.cumulative: List[float] = []
+		for rank in range(len(self.words)):
+			total += 1.0 / (rank + 1)
+			self.cumulative.append(total)
+		self.rng = rng
+
+	def word(self) -> str:
+		i = bisect.bisect_left(self.cumulative, self.rng.random() * self.cumulative[-1])
+		return self.words[min(i, len(self.words) - 1)]
+
+	def sentence(self) -> str:
+		words = [self.word() for _ in range(self.rng.randint(6, 20))]
+		words[0] = words[0].capitalize()
+		if len(words) > 8 and self.rng.random() < 0.3:
+			words[self.rng.randrange(3, len(words) - 2)] += ","
+		return " ".join(words) + self.rng.choice(".....!?")
+
+	def paragraph(self) -> str:
+		return " ".join(self.sentence() for _ in range(self.rng.randint(3, 7)))
+
+
+class Document:
+	"""Paragraphs joined by blank lines; offsets of each paragraph are kept for the truth records"""
+
+	def __init__(self):
+		self.parts: List[str] = []
+		self.size = 0
+
+	def add(self, paragraph: str) -> Tuple[int, int]:
+		if self.parts:
+			self.parts.append("\n\n")
+			self.size += 2
+		start = self.size
+		self.parts.append(paragraph)
+		self.size += len(paragraph)
+		return start, self.size
+
+	def text(self) -> str:
+		return "".join(self.parts) + "\n"
+
+
+def _make_source(model: TextModel, size: int) -> Tuple[str, List[Tuple[int, int]]]:
+	doc = Document()
+	spans = []
+	while doc.size < size:
+		spans.append(doc.add(model.paragraph()))
+	return doc.text(), spans
+
+
+def _substitute(model: TextModel, rng: random.Random, text: str) -> str:
+	words = text.split(" ")
+	for i in range(1, len(words)):
+		if rng.random() < SUBSTITUTE_RATE:
+			# Keep trailing punctuation so sentence boundaries survive
+			tail = words[i][len(words[i].rstrip(".,!?")):]
+			words[i] = model.word() + tail
+	return " ".join(words)
+
+
+def _noise(rng: random.Random, text: str) -> str:
+	out = []
+	for word in text.split(" "):
+		r = rng.random()
+		if r < NOISE_RATE / 3:
+			word = word.upper()
+		elif r < NOISE_RATE * 2 / 3:
+			word = word.lower() if word[:1].isupper() else word.capitalize()
+		out.append(word)
+		if rng.random() < NOISE_RATE / 3:
+			out.append(rng.choice(["", "\t", " "]))
+	# Empty, tab and space entries turn into doubled or mixed whitespace once joined
+	return " ".join(out) + rng.choice(["", " ", "  "])
+
+
+def _copy_passage(model: TextModel, rng: random.Random, op: str, source: Tuple[str, List[Tuple[int, int]]]) -> List[Tuple[str, int, int]]:
+	"""Returns the suspect paragraphs of one copy operation as (text, sourceStart, sourceEnd)"""
+	text, paragraphs = source
+	if op == "reorder" and len(paragraphs) >= 2:
+		count = rng.randint(2, min(4, len(paragraphs)))
+		first = rng.randrange(len(paragraphs) - count + 1)
+		chosen = paragraphs[first:first + count]
+		# Any order but the original one
+		while chosen == paragraphs[first:first + count]:
+			rng.shuffle(chosen)
+		return [(text[s:e], s, e) for s, e in chosen]
+	s, e = paragraphs[rng.randrange(len(paragraphs))]
+	if op == "verbatim":
+		# A run of whole sentences, possibly shorter than the paragraph
+		cuts = [s] + [s + i + 2 for i, ch in enumerate(text[s:e]) if ch in ".!?" and s + i + 2 < e] + [e]
+		a = rng.randrange(len(cuts) - 1)
+		b = rng.randint(a + 1, len(cuts) - 1)
+		start, end = cuts[a], cuts[b]
+		return [(text[start:end].rstrip(" "), start, start + len(text[start:end].rstrip(" ")))]
+	if op == "substitute":
+		return [(_substitute(model, rng, text[s:e]), s, e)]
+	return [(_noise(rng, text[s:e]), s, e)]
+
+
+def generate(args: argparse.Namespace) -> int:
+	ops = [op for op in args.ops.split(",") if op]
+	for op in ops:
+		if op not in OPS:
+			print(f"unknown copy operation: {op}", file=sys.stderr)
+			return 1
+	rng = random.Random(args.seed)
+	model = TextModel(rng)
+	size = _parse_size(args.size)
+	os.makedirs(os.path.join(args.out, "sources"), exist_ok=True)
+	os.makedirs(os.path.join(args.out, "suspects"), exist_ok=True)
+
+	sources = []
+	source_names = []
+	for i in range(args.sources):
+		sources.append(_make_source(model, size))
+		source_names.append(f"sources/source_{i:04d}.txt")
+		with open(os.path.join(args.out, source_names[-1]), "w", encoding="utf-8", newline="") as f:
+			f.write(sources[-1][0])
+
+	copied_bytes = 0
+	total_bytes = 0
+	with open(os.path.join(args.out, "truth.jsonl"), "w", encoding="utf-8", newline="\n") as truth, \
+			open(os.path.join(args.out, "manifest.tsv"), "w", encoding="utf-8", newline="\n") as manifest:
+		for i in range(args.suspects):
+			name = f"suspects/suspect_{i:04d}.txt"
+			doc = Document()
+			used = set()
+			passage = 0
+			while doc.size < size:
+				if ops and rng.random() < args.copy_ratio:
+					op = rng.choice(ops)
+					src = rng.randrange(len(sources))
+					used.add(src)
+					for text, source_start, source_end in _copy_passage(model, rng, op, sources[src]):
+						start, end = doc.add(text)
+						copied_bytes += end - start
+						truth.write(json.dumps({
+							"suspect": name, "source": source_names[src], "op": op, "passage": passage,
+							"suspectStart": start, "suspectEnd": end, "sourceStart": source_start, "sourceEnd": source_end,
+						}) + "\n")
+					passage += 1
+				else:
+					doc.add(model.paragraph())
+			text = doc.text()
+			total_bytes += len(text)
+			with open(os.path.join(args.out, name), "w", encoding="utf-8", newline="") as f:
+				f.write(text)
+
+			targets = sorted(used)
+			unrelated = [j for j in range(len(sources)) if j not in used]
+			targets += sorted(rng.sample(unrelated, min(args.negatives, len(unrelated))))
+			manifest.write(name + "\n")
+			for j in targets:
+				manifest.write("\t" + source_names[j] + "\n")
+
+	print(json.dumps({
+		"sources": args.sources, "suspects": args.suspects, "bytes": total_bytes + sum(len(s[0]) for s in sources),
+		"copiedShare": round(copied_bytes / total_bytes, 4) if total_bytes else 0.0, "seed": args.seed,
+	}))
+	return 0
+
+
+def _union(intervals: List[Tuple[int, int]]) -> List[Tuple[int, int]]:
+	merged: List[Tuple[int, int]] = []
+	for s, e in sorted(intervals):
+		if merged and s <= merged[-1][1]:
+			merged[-1] = (merged[-1][0], max(merged[-1][1], e))
+		elif s < e:
+			merged.append((s, e))
+	return merged
+
+
+def _overlap(a: List[Tuple[int, int]], b: List[Tuple[int, int]]) -> int:
+	"""Characters shared by two sorted, disjoint interval lists"""
+	i = j = total = 0
+	while i < len(a) and j < len(b):
+		total += max(0, min(a[i][1], b[j][1]) - max(a[i][0], b[j][0]))
+		if a[i][1] < b[j][1]:
+			i += 1
+		else:
+			j += 1
+	return total
+
+
+def evaluate(args: argparse.Namespace) -> int:
+	truth: Dict[Tuple[str, str], List[Dict[str, Any]]] = {}
+	with open(os.path.join(args.out, "truth.jsonl"), encoding="utf-8") as f:
+		for line in f:
+			rec = json.loads(line)
+			truth.setdefault((rec["suspect"], rec["source"]), []).append(rec)
+
+	cmd = [args.bin, "--stream", "--manifest", "manifest.tsv"]
+	if args.threads:
+		cmd += ["--threads", str(args.threads)]
+	if args.mode:
+		cmd += ["--mode", args.mode]
+	started = time.perf_counter()
+	proc = subprocess.run(cmd, cwd=args.out, capture_output=True, text=True, check=False)
+	elapsed = time.perf_counter() - started
+	if proc.returncode != 0:
+		print(proc.stderr.strip() or f"checker exited with {proc.returncode}", file=sys.stderr)
+		return 1
+
+	true_chars = predicted_chars = hit_chars = 0
+	per_op = {op: {"spans": 0, "chars": 0, "found": 0, "detected": 0} for op in OPS}
+	pairs = 0
+	compared_bytes = 0
+	for line in proc.stdout.splitlines():
+		rec = json.loads(line)
+		if rec.get("done"):
+			continue
+		pairs += 1
+		suspect, source = rec["fileA"], rec["fileB"]
+		compared_bytes += os.path.getsize(os.path.join(args.out, suspect)) + os.path.getsize(os.path.join(args.out, source))
+		predicted = _union([(h["rawStartA"], h["rawEndA"]) for h in rec.get("highlights", [])])
+		expected = truth.get((suspect, source), [])
+		actual = _union([(t["suspectStart"], t["suspectEnd"]) for t in expected])
+		true_chars += sum(e - s for s, e in actual)
+		predicted_chars += sum(e - s for s, e in predicted)
+		hit_chars += _overlap(actual, predicted)
+		for t in expected:
+			stats = per_op[t["op"]]
+			length = t["suspectEnd"] - t["suspectStart"]
+			found = _overlap([(t["suspectStart"], t["suspectEnd"])], predicted)
+			stats["spans"] += 1
+			stats["chars"] += length
+			stats["found"] += found
+			stats["detected"] += 1 if length and found >= DETECTED_SHARE * length else 0
+
+	precision = hit_chars / predicted_chars if predicted_chars else 1.0
+	recall = hit_chars / true_chars if true_chars else 1.0
+	f1 = 2 * precision * recall / (precision + recall) if precision + recall else 0.0
+	print(json.dumps({
+		"pairs": pairs,
+		"seconds": round(elapsed, 3),
+		"mbPerSec": round(compared_bytes / (1 << 20) / elapsed, 3) if elapsed else 0.0,
+		"precision": round(precision, 4),
+		"recall": round(recall, 4),
+		"f1": round(f1, 4),
+		"ops": {
+			op: {
+				"spans": s["spans"],
+				"recall": round(s["found"] / s["chars"], 4) if s["chars"] else None,
+				"detected": round(s["detected"] / s["spans"], 4) if s["spans"] else None,
+			} for op, s in per_op.items() if s["spans"]
+		},
+	}))
+	return 0
+
+
+def main() -> int:
+	parser = argparse.ArgumentParser(description="Synthetic plagiarism corpus with ground truth")
+	sub = parser.add_subparsers(dest="command", required=True)
+	gen = sub.add_parser("generate", help="write sources, suspects, truth.jsonl and manifest.tsv")
+	gen.add_argument("out")
+	gen.add_argument("--sources", type=int, default=20)
+	gen.add_argument("--suspects", type=int, default=20)
+	gen.add_argument("--size", default="20K", help="approximate size of each document, e.g. 20K or 5M")
+	gen.add_argument("--copy-ratio", type=float, default=0.4, help="share of suspect paragraphs taken from sources")
+	gen.add_argument("--ops", default=",".join(OPS), help="copy operations to use: " + ",".join(OPS))
+	gen.add_argument("--negatives", type=int, default=2, help="unrelated sources per suspect in the manifest")
+	gen.add_argument("--seed", type=int, default=1)
+	ev = sub.add_parser("evaluate", help="score the C++ checker against a generated corpus")
+	ev.add_argument("out")
+	ev.add_argument("--bin", default=None, help="checker binary (default: bin/cpp_checker)")
+	ev.add_argument("--threads", type=int, default=0)
+	ev.add_argument("--mode", choices=["char", "word", "code"], default=None, help="checker tokenization (default: the checker's)")
+	args = parser.parse_args()
+	if args.command == "generate":
+		if args.sources < 1:
+			parser.error("--sources must be at least 1")
+		return generate(args)
+	if args.bin is None:
+		from checker import CPP_BIN
+		args.bin = CPP_BIN
+	args.bin = os.path.abspath(args.bin)
+	return evaluate(args)
+
+
+if __name__ == "__main__":
+	sys.exit(main())
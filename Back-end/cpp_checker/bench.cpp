@@ -0,0 +1,294 @@
+// Microbenchmarks for the checker hot paths on synthetic document pairs.
+//
+//   g++ -O2 -pthread -o bench cpp_checker/bench.cpp
+//   ./bench [--sizes 1K,10K,100K,1M] [--overlaps 0,10,50,100] [--min-ms 200] [--max-reps 50]
+//           [--only NAME] [--format ndjson|csv]
+//
+// Every document pair is generated from a fixed seed: B is cut into paragraph-sized chunks and the
+// given percentage of them are copied from random places in A, the rest are fresh text. Each
+// benchmark repeats until --min-ms has passed (at least once) and prints one record with the
+// minimum, median and mean time per repetition, so runs of two versions can be diffed directly.
+#define CPP_CHECKER_NO_MAIN
+#include "main.cpp"
+
+#include <cstdio>
+
+namespace {
+
+// xorshift64*: fixed-seed stream so every run benchmarks the same texts
+class Rng {
+	uint64_t state;
+
+public:
+	explicit Rng(uint64_t seed) : state(seed ? seed : 1) {}
+
+	uint64_t next() {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1DULL;
+	}
+
+	int below(int n) { return (int)(next() % (uint64_t)n); }
+};
+
+// Lowercase words with sentence punctuation, line breaks and blank lines between paragraphs
+static std::string randomText(Rng &rng, size_t size) {
+	static const char letters[] = "etaoinshrdlucmfwypvbgkjqxz";
+	std::string s;
+	s.reserve(size + 16);
+	int wordsInSentence = 0, sentencesInParagraph = 0;
+	while (s.size() < size) {
+		int len = 2 + rng.below(8);
+		// Skewed letter choice gives English-like k-gram repetition
+		for (int i = 0; i < len; ++i) s += letters[std::min(rng.below(26), rng.below(26))];
+		if (++wordsInSentence >= 6 + rng.below(12)) {
+			s += '.';
+			wordsInSentence = 0;
+			if (++sentencesInParagraph >= 3 + rng.below(5)) {
+				s += "\n\n";
+				sentencesInParagraph = 0;
+				continue;
+			}
+			s += rng.below(4) == 0 ? '\n' : ' ';
+			continue;
+		}
+		s += ' ';
+	}
+	s.resize(size);
+	return s;
+}
+
+struct DocumentPair {
+	std::string a;
+	std::string b;
+};
+
+// B reuses `overlap` percent of its chunks verbatim from random offsets in A
+static DocumentPair makePair(size_t size, int overlap, uint64_t seed) {
+	const size_t chunk = 512;
+	Rng rng(seed);
+	DocumentPair pair;
+	pair.a = randomText(rng, size);
+	std::string fresh = randomText(rng, size);
+	size_t chunks = (size + chunk - 1) / chunk;
+	pair.b.reserve(size);
+	for (size_t c = 0; c < chunks; ++c) {
+		size_t len = std::min(chunk, size - c * chunk);
+		// Spread the copied chunks evenly: chunk c is copied when the running share crosses a step
+		bool copied = (c + 1) * overlap / 100 > c * overlap / 100;
+		if (copied && size > len) {
+			size_t from = (size_t)(rng.next() % (uint64_t)(size - len));
+			pair.b.append(pair.a, from, len);
+		} else if (copied) {
+			pair.b.append(pair.a, 0, len);
+		} else {
+			pair.b.append(fresh, c * chunk, len);
+		}
+	}
+	return pair;
+}
+
+struct Measurement {
+	int reps = 0;
+	double minNs = 0, medianNs = 0, meanNs = 0;
+};
+
+// Runs setup() untimed and body() timed until minMs has passed or maxReps is reached
+template <class Setup, class Body>
+static Measurement measure(int minMs, int maxReps, Setup setup, Body body) {
+	typedef std::chrono::steady_clock Clock;
+	std::vector<double> samples;
+	double elapsed = 0;
+	while (samples.empty() || (elapsed < minMs * 1e6 && (int)samples.size() < maxReps)) {
+		setup();
+		auto t0 = Clock::now();
+		body();
+		double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+		samples.push_back(ns);
+		elapsed += ns;
+	}
+	Measurement m;
+	m.reps = (int)samples.size();
+	m.meanNs = elapsed / m.reps;
+	std::sort(samples.begin(), samples.end());
+	m.minNs = samples.front();
+	m.medianNs = samples[samples.size() / 2];
+	return m;
+}
+
+struct Options {
+	std::vector<size_t> sizes{1 << 10, 10 << 10, 100 << 10, 1 << 20};
+	std::vector<int> overlaps{0, 10, 50, 100};
+	int minMs = 200;
+	int maxReps = 50;
+	std::string only;
+	bool csv = false;
+};
+
+class Reporter {
+	const Options &opt;
+
+public:
+	explicit Reporter(const Options &o) : opt(o) {
+		if (opt.csv) {
+			std::printf("bench,size,overlap,bytes,items,reps,min_ns,median_ns,mean_ns,mb_per_s\n");
+		} else {
+			std::printf("{\"bench\":\"meta\",\"params\":\"%s\",\"compiler\":\"%s\",\"minMs\":%d,\"maxReps\":%d}\n",
+				checkerParams(), jsonEscape(__VERSION__).c_str(), opt.minMs, opt.maxReps);
+		}
+		std::fflush(stdout);
+	}
+
+	bool wanted(const char *name) const { return opt.only.empty() || opt.only == name; }
+
+	// `bytes` is the input volume one repetition processes; `items` counts its unit of work
+	void report(const char *name, size_t size, int overlap, size_t bytes, long long items, const Measurement &m) {
+		double mbPerSec = m.minNs > 0 ? (double)bytes / (1 << 20) / (m.minNs / 1e9) : 0.0;
+		if (opt.csv) {
+			std::printf("%s,%zu,%d,%zu,%lld,%d,%.0f,%.0f,%.0f,%.2f\n", name, size, overlap, bytes, items, m.reps, m.minNs,
+				m.medianNs, m.meanNs, mbPerSec);
+		} else {
+			std::printf("{\"bench\":\"%s\",\"size\":%zu,\"overlap\":%d,\"bytes\":%zu,\"items\":%lld,\"reps\":%d,"
+				"\"minNs\":%.0f,\"medianNs\":%.0f,\"meanNs\":%.0f,\"mbPerSec\":%.2f}\n",
+				name, size, overlap, bytes, items, m.reps, m.minNs, m.medianNs, m.meanNs, mbPerSec);
+		}
+		std::fflush(stdout);
+	}
+};
+
+static void runPair(Reporter &out, const Options &opt, size_t size, int overlap) {
+	DocumentPair pair = makePair(size, overlap, 0x9e3779b97f4a7c15ULL ^ (size * 131 + (size_t)overlap));
+	size_t pairBytes = pair.a.size() + pair.b.size();
+
+	// Document preprocessing only depends on the size, so it is measured with the first overlap
+	if (overlap == opt.overlaps.front()) {
+		if (out.wanted("preprocess")) {
+			std::string text;
+			std::vector<int> map;
+			auto m = measure(opt.minMs, opt.maxReps, [] {}, [&] { Document::preprocess(pair.a, text, map); });
+			out.report("preprocess", size, overlap, pair.a.size(), (long long)text.size(), m);
+		}
+		if (out.wanted("document")) {
+			auto m = measure(opt.minMs, opt.maxReps, [] {}, [&] { Document doc(pair.a); });
+			out.report("document", size, overlap, pair.a.size(), 1, m);
+		}
+	}
+
+	Document a(pair.a), b(pair.b);
+	const int window = RabinKarpChecker::window;
+	if (out.wanted("findOccurrences") && (int)a.text.size() >= window && (int)b.text.size() >= window) {
+		WindowIndex index;
+		index.build(b.text, window);
+		std::vector<int> occ;
+		long long probes = 0, found = 0;
+		auto m = measure(opt.minMs, opt.maxReps, [&] { probes = found = 0; }, [&] {
+			for (int i = 0; i + window <= (int)a.text.size(); i += RabinKarpChecker::step) {
+				index.findOccurrences(WindowIndex::keyAt(a.text, i, window), occ);
+				found += (long long)occ.size();
+				probes++;
+			}
+		});
+		out.report("findOccurrences", size, overlap, a.text.size(), probes, m);
+	}
+
+	RabinKarpChecker rk;
+	if (out.wanted("rk.score")) {
+		auto m = measure(opt.minMs, opt.maxReps, [] {}, [&] { rk.score(a, b); });
+		out.report("rk.score", size, overlap, pairBytes, (long long)rk.matches().size(), m);
+	}
+	if (out.wanted("lcs")) {
+		// Bit-parallel LCS over the first 4K characters of each text, the largest spans the
+		// highlight refiner bounds this way
+		BitParallelLcs lcs;
+		int la = std::min((int)a.text.size(), 4096), lb = std::min((int)b.text.size(), 4096);
+		int common = 0;
+		auto m = measure(opt.minMs, opt.maxReps, [] {}, [&] { common = lcs.length(a.text.data(), la, b.text.data(), lb); });
+		out.report("lcs", size, overlap, (size_t)(la + lb), (long long)common, m);
+	}
+	if (out.wanted("jaccard.score")) {
+		JaccardChecker jc;
+		auto m = measure(opt.minMs, opt.maxReps, [] {}, [&] { jc.score(a, b); });
+		out.report("jaccard.score", size, overlap, pairBytes, 1, m);
+	}
+	if (out.wanted("finalizeSpans")) {
+		rk.score(a, b);
+		const std::vector<MatchSpan> found = rk.matches();
+		std::vector<MatchSpan> spans;
+		auto m = measure(opt.minMs, opt.maxReps, [&] { spans = found; }, [&] { finalizeSpans(a, b, spans); });
+		out.report("finalizeSpans", size, overlap, pairBytes, (long long)found.size(), m);
+	}
+	if (out.wanted("comparePair") || out.wanted("json")) {
+		WorkerContext ctx;
+		PairResult r;
+		if (out.wanted("comparePair")) {
+			auto m = measure(opt.minMs, opt.maxReps, [] {}, [&] { r = comparePair(a, b, ctx); });
+			out.report("comparePair", size, overlap, pairBytes, (long long)r.highlights.size(), m);
+		} else {
+			r = comparePair(a, b, ctx);
+		}
+		if (out.wanted("json")) {
+			size_t written = 0;
+			auto m = measure(opt.minMs, opt.maxReps, [] {}, [&] {
+				std::ostringstream json;
+				writeResultJson(json, a, b, r);
+				written = (size_t)json.tellp();
+			});
+			out.report("json", size, overlap, written, (long long)(r.spans.size() + r.highlights.size()), m);
+		}
+	}
+}
+
+// "64K" / "10M" / "1G" / plain bytes
+static size_t parseSize(const std::string &s) {
+	size_t n = (size_t)std::atoll(s.c_str());
+	char unit = s.empty() ? 0 : (char)std::toupper((unsigned char)s.back());
+	if (unit == 'K') n <<= 10;
+	else if (unit == 'M') n <<= 20;
+	else if (unit == 'G') n <<= 30;
+	return n;
+}
+
+template <class T, class Parse>
+static std::vector<T> parseList(const std::string &s, Parse parse) {
+	std::vector<T> out;
+	std::stringstream ss(s);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (!item.empty()) out.push_back(parse(item));
+	}
+	return out;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	Options opt;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--sizes" && i + 1 < argc) {
+			opt.sizes = parseList<size_t>(argv[++i], parseSize);
+		} else if (arg == "--overlaps" && i + 1 < argc) {
+			opt.overlaps = parseList<int>(argv[++i], [](const std::string &s) { return std::max(0, std::min(100, std::atoi(s.c_str()))); });
+		} else if (arg == "--min-ms" && i + 1 < argc) {
+			opt.minMs = std::atoi(argv[++i]);
+		} else if (arg == "--max-reps" && i + 1 < argc) {
+			opt.maxReps = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--only" && i + 1 < argc) {
+			opt.only = argv[++i];
+		} else if (arg == "--format" && i + 1 < argc) {
+			opt.csv = std::string(argv[++i]) == "csv";
+		} else {
+			std::cerr << "Usage: bench [--sizes 1K,10K,100K,1M] [--overlaps 0,10,50,100] [--min-ms MS] [--max-reps N]" << std::endl;
+			std::cerr << "             [--only preprocess|document|findOccurrences|rk.score|lcs|jaccard.score|finalizeSpans|comparePair|json]" << std::endl;
+			std::cerr << "             [--format ndjson|csv]" << std::endl;
+			return 1;
+		}
+	}
+	if (opt.sizes.empty() || opt.overlaps.empty()) return 1;
+	Reporter out(opt);
+	for (size_t size : opt.sizes) {
+		for (int overlap : opt.overlaps) runPair(out, opt, size, overlap);
+	}
+	return 0;
+}
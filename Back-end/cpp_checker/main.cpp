@@ -1,13 +1,322 @@
 // OOP C++ plagiarism checker with Rabin-Karp and Jaccard Shingling
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+// Bit helpers that also build with MSVC
+static inline int ctz64(uint64_t x) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return (int)i;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+// Index of the highest set bit; x must be non-zero
+static inline int highBit32(uint32_t x) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanReverse(&i, x);
+	return (int)i;
+#else
+	return 31 - __builtin_clz(x);
+#endif
+}
+
+static inline int popcount64(uint64_t x) {
+#ifdef _MSC_VER
+	return (int)__popcnt64(x);
+#else
+	return __builtin_popcountll(x);
+#endif
+}
+
+// Python's str.isspace() for single-byte characters
+static bool isTextSpace(unsigned char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r') || (c >= 0x1c && c <= 0x1f);
+}
+
+// 1-based line containing raw offset `pos`
+static int rawLineOf(const std::vector<int> &starts, int pos) {
+	int line = (int)(std::upper_bound(starts.begin(), starts.end(), std::max(pos, 0)) - starts.begin());
+	return std::max(line, 1);
+}
+
+// Unit the fingerprinting engines work on: characters of the processed text (the default), or a
+// token stream built on top of it (--mode word, --mode code)
+enum class TokenMode { chars, words, code };
+
+static const char *tokenModeName(TokenMode mode) {
+	return mode == TokenMode::words ? "word" : mode == TokenMode::code ? "code" : "char";
+}
+
+// Word -> id table shared by every document of a run, so equal words get equal ids across
+// documents. Lookups take a shared lock; new words are added under an exclusive one.
+class Vocabulary {
+private:
+	std::shared_mutex m;
+	std::unordered_map<std::string, uint32_t> ids;
+
+public:
+	// Ids of `words` in `out`, adding the words not seen before. Callers pass a document's
+	// distinct words, so each document costs one round of locking.
+	void intern(const std::vector<std::string_view> &words, std::vector<uint32_t> &out) {
+		out.assign(words.size(), 0);
+		std::vector<size_t> missing;
+		{
+			std::shared_lock<std::shared_mutex> lock(m);
+			for (size_t i = 0; i < words.size(); ++i) {
+				auto it = ids.find(std::string(words[i]));
+				if (it != ids.end()) out[i] = it->second;
+				else missing.push_back(i);
+			}
+		}
+		if (missing.empty()) return;
+		std::unique_lock<std::shared_mutex> lock(m);
+		for (size_t i : missing) out[i] = ids.emplace(std::string(words[i]), (uint32_t)ids.size()).first->second;
+	}
+
+	size_t size() {
+		std::shared_lock<std::shared_mutex> lock(m);
+		return ids.size();
+	}
+};
+
+// Comment syntax the code mode lexes with. C, C++ and Java share `//` and `/* */` comments; in
+// Python `#` starts a comment and `//` is floor division.
+enum class CodeLanguage { cFamily, python };
+
+static const char *codeLanguageName(CodeLanguage language) {
+	return language == CodeLanguage::python ? "python" : "c";
+}
+
+// Table-driven lexer for the code mode. It reads the processed text (lowercased, so keywords are
+// matched in lowercase) and keeps what survives identifier renaming: keywords and operators of
+// C, C++, Java and Python keep their own token, every identifier becomes one `identifier` token
+// and every number, string or character literal one `number` or `string` token. Comments are
+// dropped; `#` starts a comment in both language families, which in C drops preprocessor lines.
+// Token ids come from fixed tables rather than a Vocabulary, so documents lex without locking and
+// ids are the same in every run.
+class CodeLexer {
+public:
+	// Ids 0-255 are single-byte punctuation by byte value
+	enum : uint32_t { identifier = 256, number, string, firstOperator };
+
+	// Python for .py, .pyw and .pyi files, the C family for everything else
+	static CodeLanguage languageOf(const std::string &path) {
+		std::string ext = std::filesystem::path(path).extension().string();
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		return ext == ".py" || ext == ".pyw" || ext == ".pyi" ? CodeLanguage::python : CodeLanguage::cFamily;
+	}
+
+private:
+	enum CharClass : unsigned char { space, identStart, digit, quote, slash, hash, dot, punct };
+
+	struct Tables {
+		CharClass classOf[256];
+		std::unordered_map<std::string_view, uint32_t> keywords;
+		std::unordered_map<std::string_view, uint32_t> operators;  // two and three characters
+		uint32_t count;
+
+		Tables() {
+			for (int c = 0; c < 256; ++c) {
+				classOf[c] = c >= 0x80 || std::isalpha(c) || c == '_' || c == '$' ? identStart
+					: std::isdigit(c) ? digit : std::isspace(c) ? space : punct;
+			}
+			classOf[(unsigned char)'"'] = classOf[(unsigned char)'\''] = quote;
+			classOf[(unsigned char)'/'] = slash;
+			classOf[(unsigned char)'#'] = hash;
+			classOf[(unsigned char)'.'] = dot;
+			static const char *const ops[] = {
+				"<<=", ">>=", ">>>", "<=>", "->*", "**=", "...",
+				"->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "+=", "-=", "*=", "/=", "%=",
+				"&=", "|=", "^=", "::", "**", ":=", ".*",
+				// Python floor division; the C family lexes `//` as a comment before looking here
+				"//=", "//",
+			};
+			static const char *const words[] = {
+				// C
+				"auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum",
+				"extern", "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return",
+				"short", "signed", "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void",
+				"volatile", "while",
+				// C++
+				"alignas", "alignof", "and", "bool", "catch", "class", "constexpr", "const_cast", "decltype",
+				"delete", "dynamic_cast", "explicit", "export", "false", "friend", "mutable", "namespace", "new",
+				"noexcept", "not", "nullptr", "operator", "or", "private", "protected", "public",
+				"reinterpret_cast", "static_assert", "static_cast", "template", "this", "throw", "true", "try",
+				"typeid", "typename", "using", "virtual",
+				// Java
+				"abstract", "assert", "boolean", "byte", "extends", "final", "finally", "implements", "import",
+				"instanceof", "interface", "native", "package", "super", "synchronized", "throws", "transient",
+				"var",
+				// Python
+				"as", "async", "await", "def", "del", "elif", "except", "from", "global", "in", "is", "lambda",
+				"none", "nonlocal", "pass", "raise", "with", "yield",
+			};
+			count = firstOperator;
+			for (const char *op : ops) operators.emplace(op, count++);
+			for (const char *w : words) keywords.emplace(w, count++);
+		}
+	};
+
+	static const Tables &tables() {
+		static const Tables t;
+		return t;
+	}
+
+public:
+	// Appends the tokens of `s` with the [start, end) range each one covers
+	static void lex(const std::string &s, CodeLanguage language, std::vector<uint32_t> &tokens, std::vector<int> &starts,
+			std::vector<int> &ends) {
+		const Tables &t = tables();
+		const bool slashComments = language == CodeLanguage::cFamily;
+		const int n = (int)s.size();
+		auto at = [&](int i) { return i < n ? (unsigned char)s[i] : 0; };
+		auto emit = [&](uint32_t id, int start, int end) {
+			tokens.push_back(id);
+			starts.push_back(start);
+			ends.push_back(end);
+		};
+		auto scanString = [&](int i) {
+			unsigned char q = at(i);
+			if (at(i + 1) == q && at(i + 2) == q) {
+				// Python triple-quoted string, may span lines
+				for (i += 3; i < n; ++i) {
+					if (at(i) == '\\') ++i;
+					else if (at(i) == q && at(i + 1) == q && at(i + 2) == q) return i + 3;
+				}
+				return n;
+			}
+			for (++i; i < n && at(i) != '\n'; ++i) {
+				if (at(i) == '\\') ++i;
+				else if (at(i) == q) return i + 1;
+			}
+			return std::min(i, n);
+		};
+		for (int i = 0; i < n;) {
+			unsigned char c = at(i);
+			int start = i;
+			switch (t.classOf[c]) {
+			case space:
+				++i;
+				break;
+			case identStart: {
+				while (i < n && (t.classOf[at(i)] == identStart || t.classOf[at(i)] == digit)) ++i;
+				std::string_view word(s.data() + start, (size_t)(i - start));
+				// String prefixes: r"", b'', f"", u8"", L"" ...
+				if (t.classOf[at(i)] == quote && word.size() <= 2 && word.find_first_not_of("rbful8") == std::string_view::npos) {
+					i = scanString(i);
+					emit(string, start, i);
+					break;
+				}
+				auto kw = t.keywords.find(word);
+				emit(kw != t.keywords.end() ? kw->second : (uint32_t)identifier, start, i);
+				break;
+			}
+			case dot:
+				if (t.classOf[at(i + 1)] != digit) goto op;
+				// fall through
+			case digit:
+				for (++i; i < n; ++i) {
+					unsigned char d = at(i);
+					if (t.classOf[d] == digit || t.classOf[d] == identStart || d == '.' || d == '\'') continue;
+					// Exponent signs: 1e-5, 0x1p+3
+					if ((d == '+' || d == '-') && (at(i - 1) == 'e' || at(i - 1) == 'p') && t.classOf[at(i + 1)] == digit) continue;
+					break;
+				}
+				emit(number, start, i);
+				break;
+			case quote:
+				i = scanString(i);
+				emit(string, start, i);
+				break;
+			case hash:
+				while (i < n && at(i) != '\n') ++i;
+				break;
+			case slash:
+				if (!slashComments) goto op;
+				if (at(i + 1) == '/') {
+					while (i < n && at(i) != '\n') ++i;
+					break;
+				}
+				if (at(i + 1) == '*') {
+					size_t close = s.find("*/", (size_t)i + 2);
+					i = close == std::string::npos ? n : (int)close + 2;
+					break;
+				}
+				goto op;
+			case punct:
+			op: {
+				// Longest operator first, then the single byte
+				uint32_t id = c;
+				int len = 1;
+				for (int l = 3; l >= 2 && len == 1; --l) {
+					if (i + l > n) continue;
+					auto it = t.operators.find(std::string_view(s.data() + i, (size_t)l));
+					if (it != t.operators.end()) {
+						id = it->second;
+						len = l;
+					}
+				}
+				i += len;
+				emit(id, start, i);
+				break;
+			}
+			}
+		}
+	}
+};
 
 class Document {
 public:
@@ -15,6 +324,18 @@ public:
     std::string text;
     std::vector<int> indexMap; // map processed index -> raw index
     std::vector<int> lineStarts;
+    // Raw-text position index, built once per document
+    std::vector<int> rawLines;                      // line starts, split like str.splitlines()
+    std::vector<int> rawSentences;                  // first character of every sentence
+    std::vector<std::pair<int, int>> rawParagraphs; // [start, end); blank lines end a paragraph
+    std::vector<int> charBase;                      // characters before each 64-byte block; empty if ASCII
+    // Token stream of the word and code modes: one id per token and the processed-text range it
+    // covers; indexMap[tokenStart[t]] is where token t starts in the raw text
+    TokenMode tokenMode = TokenMode::chars;
+    CodeLanguage codeLanguage = CodeLanguage::cFamily;  // comment syntax of the code mode
+    std::vector<uint32_t> tokens;
+    std::vector<int> tokenStart;
+    std::vector<int> tokenEnd;
     // Preprocess: lowercase and normalize whitespace, preserve newlines, and build index map
     static void preprocess(const std::string& s, std::string& out, std::vector<int>& map) {
         out.clear();
@@ -45,13 +366,67 @@ public:
     explicit Document(std::string t) : raw(std::move(t)) {
         preprocess(raw, text, indexMap);
         calculateLineStarts();
+        buildRawIndex();
     }
 
-	static Document fromFile(const std::string &path) {
+	// False if the file cannot be opened or read, e.g. it is missing or a directory
+	static bool readFile(const std::string &path, std::string &content) {
 		std::ifstream in(path);
+		if (!in) return false;
 		std::ostringstream ss;
 		ss << in.rdbuf();
-		return Document(ss.str());
+		in.peek();
+		if (in.bad()) return false;
+		content = ss.str();
+		return true;
+	}
+
+	// Approximate heap footprint, used to bound the DocumentCache
+	size_t bytes() const {
+		return raw.capacity() + text.capacity()
+			+ (indexMap.capacity() + lineStarts.capacity() + rawLines.capacity() + rawSentences.capacity() + charBase.capacity()) * sizeof(int)
+			+ rawParagraphs.capacity() * sizeof(std::pair<int, int>)
+			+ tokens.capacity() * sizeof(uint32_t) + (tokenStart.capacity() + tokenEnd.capacity()) * sizeof(int);
+	}
+
+	// Splits the processed text into words (runs of letters, digits and non-ASCII bytes) and
+	// interns them. Distinct words are collected first, so the shared vocabulary is locked once.
+	void tokenizeWords(Vocabulary &vocabulary) {
+		tokens.clear();
+		tokenStart.clear();
+		tokenEnd.clear();
+		std::unordered_map<std::string_view, uint32_t> local;
+		std::vector<std::string_view> distinct;
+		const int n = (int)text.size();
+		auto isWordByte = [](unsigned char c) { return std::isalnum(c) || c >= 0x80; };
+		for (int i = 0; i < n;) {
+			if (!isWordByte((unsigned char)text[i])) {
+				++i;
+				continue;
+			}
+			int start = i;
+			while (i < n && isWordByte((unsigned char)text[i])) ++i;
+			std::string_view word(text.data() + start, (size_t)(i - start));
+			auto it = local.emplace(word, (uint32_t)distinct.size()).first;
+			if (it->second == distinct.size()) distinct.push_back(word);
+			tokens.push_back(it->second);
+			tokenStart.push_back(start);
+			tokenEnd.push_back(i);
+		}
+		std::vector<uint32_t> ids;
+		vocabulary.intern(distinct, ids);
+		for (auto &t : tokens) t = ids[t];
+		tokenMode = TokenMode::words;
+	}
+
+	// Splits the processed text into normalised source-code tokens (see CodeLexer)
+	void tokenizeCode(CodeLanguage language) {
+		tokens.clear();
+		tokenStart.clear();
+		tokenEnd.clear();
+		CodeLexer::lex(text, language, tokens, tokenStart, tokenEnd);
+		tokenMode = TokenMode::code;
+		codeLanguage = language;
 	}
 
 	static std::string toLower(const std::string &s) {
@@ -70,13 +445,181 @@ public:
         }
     }
 
-	int getLineNumber(int position) const {
-		for (size_t i = 0; i < lineStarts.size(); ++i) {
-			if (i + 1 < lineStarts.size() && position < lineStarts[i + 1]) {
-				return static_cast<int>(i + 1);
+	// Builds the raw position index in one pass. Blocks of bytes are tested at once and only
+	// control bytes, non-ASCII bytes and sentence punctuation are looked at individually, so
+	// ordinary text is scanned at close to memory bandwidth. Lines break at \n, \r\n, \r, \v, \f, \x1c-\x1e,
+	// U+0085, U+2028 and U+2029; sentences start after . ! ? followed by a space or tab.
+	void buildRawIndex() {
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(raw.data());
+		const int n = (int)raw.size();
+		const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+		auto hasByte = [&](uint64_t w, unsigned char c) {
+			uint64_t x = w ^ (ones * c);
+			return (x - ones) & ~x & highs;
+		};
+		auto startSentence = [&](int i) {
+			while (i < n && (p[i] == ' ' || p[i] == '\t')) ++i;
+			if (i < n && !isTextSpace(p[i])) rawSentences.push_back(i);
+		};
+		rawLines.assign(1, 0);
+		rawSentences.clear();
+		charBase.clear();
+		bool ascii = true;
+		// Looks at one flagged byte and returns where scanning resumes
+		auto visit = [&](int i) {
+			unsigned char c = p[i];
+			int next = -1;
+			if (c == '\n' || c == '\v' || c == '\f' || (c >= 0x1c && c <= 0x1e)) {
+				next = i + 1;
+			} else if (c == '\r') {
+				next = i + 1 < n && p[i + 1] == '\n' ? i + 2 : i + 1;
+			} else if (c >= 0x80) {
+				ascii = false;
+				if (c == 0xC2 && i + 1 < n && p[i + 1] == 0x85) next = i + 2;
+				else if (c == 0xE2 && i + 2 < n && p[i + 1] == 0x80 && (p[i + 2] == 0xA8 || p[i + 2] == 0xA9)) next = i + 3;
+			} else if ((c == '.' || c == '!' || c == '?') && i + 1 < n && (p[i + 1] == ' ' || p[i + 1] == '\t')) {
+				startSentence(i + 1);
+			}
+			if (next < 0) return i + 1;
+			if (next < n) {
+				rawLines.push_back(next);
+				startSentence(next);
 			}
+			return next;
+		};
+		startSentence(0);
+		int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+		// Sixteen bytes per step. Flagged are control bytes, the first byte of U+0085, U+2028 and
+		// U+2029, and punctuation followed by a space or tab; every flagged byte of the block is
+		// visited from the mask. Other non-ASCII bytes are only noted through their sign bits.
+		const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), zero = _mm_setzero_si128();
+		const __m128i dot = _mm_set1_epi8('.'), bang = _mm_set1_epi8('!'), query = _mm_set1_epi8('?');
+		const __m128i c2 = _mm_set1_epi8((char)0xC2), e2 = _mm_set1_epi8((char)0xE2), x80 = _mm_set1_epi8((char)0x80);
+		const __m128i x85 = _mm_set1_epi8((char)0x85), xa8 = _mm_set1_epi8((char)0xA8), xa9 = _mm_set1_epi8((char)0xA9);
+		unsigned high = 0;
+		while (i + 18 <= n) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+			__m128i next1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + 1));
+			unsigned sign = (unsigned)_mm_movemask_epi8(v);
+			high |= sign;
+			__m128i control = _mm_andnot_si128(_mm_cmplt_epi8(v, zero), _mm_cmplt_epi8(v, space));
+			__m128i punct = _mm_or_si128(_mm_cmpeq_epi8(v, dot), _mm_or_si128(_mm_cmpeq_epi8(v, bang), _mm_cmpeq_epi8(v, query)));
+			__m128i gap = _mm_or_si128(_mm_cmpeq_epi8(next1, space), _mm_cmpeq_epi8(next1, tab));
+			__m128i flagged = _mm_or_si128(control, _mm_and_si128(punct, gap));
+			if (sign) {
+				__m128i next2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + 2));
+				__m128i nel = _mm_and_si128(_mm_cmpeq_epi8(v, c2), _mm_cmpeq_epi8(next1, x85));
+				__m128i sep = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(v, e2), _mm_cmpeq_epi8(next1, x80)),
+					_mm_or_si128(_mm_cmpeq_epi8(next2, xa8), _mm_cmpeq_epi8(next2, xa9)));
+				flagged = _mm_or_si128(flagged, _mm_or_si128(nel, sep));
+			}
+			unsigned mask = (unsigned)_mm_movemask_epi8(flagged);
+			int base = i, resume = i;
+			i += 16;
+			while (mask) {
+				int k = base + ctz64(mask);
+				mask &= mask - 1;
+				if (k >= resume) resume = visit(k);
+			}
+			i = std::max(i, resume);
+		}
+		if (high) ascii = false;
+#endif
+		// Eight bytes per step otherwise; only the lowest flagged byte of a word is exact, so
+		// scanning jumps to it and tests again from there
+		while (i < n) {
+			if (i + 8 <= n) {
+				uint64_t w;
+				std::memcpy(&w, p + i, 8);
+				uint64_t flagged = (((w - ones * 0x20) | w) & highs) | hasByte(w, '.') | hasByte(w, '!') | hasByte(w, '?');
+				if (!flagged) {
+					i += 8;
+					continue;
+				}
+				i += ctz64(flagged) >> 3;
+			}
+			i = visit(i);
+		}
+
+		// A paragraph keeps its trailing blank lines
+		rawParagraphs.clear();
+		int start = 0;
+		bool gap = false;
+		for (size_t l = 0; l < rawLines.size(); ++l) {
+			int from = rawLines[l];
+			int to = l + 1 < rawLines.size() ? rawLines[l + 1] : n;
+			bool blank = true;
+			for (int k = from; k < to && blank; ++k) blank = isTextSpace(p[k]);
+			if (blank) {
+				gap = true;
+			} else {
+				if (gap && from > start) {
+					rawParagraphs.push_back({start, from});
+					start = from;
+				}
+				gap = false;
+			}
+		}
+		if (n > start) rawParagraphs.push_back({start, n});
+
+		// Character counts per block, so offsets can be reported in characters like Python's
+		if (!ascii) {
+			// Continuation bytes are 10xxxxxx; count them eight at a time
+			int chars = 0;
+			charBase.reserve(n / 64 + 2);
+			for (int b = 0; b < n; b += 64) {
+				charBase.push_back(chars);
+				int k = b, end = std::min(n, b + 64);
+				int continuation = 0;
+				for (; k + 8 <= end; k += 8) {
+					uint64_t w;
+					std::memcpy(&w, p + k, 8);
+					continuation += popcount64(w & ~(w << 1) & highs);
+				}
+				for (; k < end; ++k) continuation += (p[k] & 0xC0) == 0x80;
+				chars += (end - b) - continuation;
+			}
+			charBase.push_back(chars);
 		}
-		return static_cast<int>(lineStarts.size());
+	}
+
+	int lineOf(int pos) const {
+		return rawLineOf(rawLines, pos);
+	}
+
+	// 1-based sentence containing raw offset `pos` (0 before the first sentence)
+	int sentenceOf(int pos) const {
+		return (int)(std::upper_bound(rawSentences.begin(), rawSentences.end(), pos) - rawSentences.begin());
+	}
+
+	// Characters (UTF-8 code points) before raw byte offset `pos`
+	int charOffset(int pos) const {
+		pos = std::max(0, std::min(pos, (int)raw.size()));
+		if (charBase.empty()) return pos;
+		int chars = charBase[pos >> 6];
+		for (int k = pos & ~63; k < pos; ++k) chars += ((unsigned char)raw[k] & 0xC0) != 0x80;
+		return chars;
+	}
+
+	// 1-based column of raw offset `pos` in its line, in characters
+	int columnOf(int pos) const {
+		return charOffset(pos) - charOffset(rawLines[lineOf(pos) - 1]) + 1;
+	}
+
+	// Byte offsets moved back / forward to the nearest character boundary
+	int charStart(int pos) const {
+		while (pos > 0 && pos < (int)raw.size() && ((unsigned char)raw[pos] & 0xC0) == 0x80) --pos;
+		return pos;
+	}
+	int charEnd(int pos) const {
+		while (pos > 0 && pos < (int)raw.size() && ((unsigned char)raw[pos] & 0xC0) == 0x80) ++pos;
+		return pos;
+	}
+
+	int getLineNumber(int position) const {
+		int line = static_cast<int>(std::upper_bound(lineStarts.begin(), lineStarts.end(), position) - lineStarts.begin());
+		return std::max(line, 1);
 	}
 
     std::string getTextAround(int start, int end, int context = 50) const {
@@ -97,6 +640,18 @@ public:
         if (rawStart < 0 || rawStart >= (int)raw.size() || rawEnd <= rawStart) return std::string();
         return raw.substr(rawStart, rawEnd - rawStart);
     }
+
+    // Raw offset of the first character of a processed position
+    int rawStart(int startProcessed) const {
+        if (indexMap.empty()) return 0;
+        return indexMap[std::min(std::max(startProcessed, 0), (int)indexMap.size() - 1)];
+    }
+
+    // Raw offset just past the last character of a processed range ending at endProcessed
+    int rawEnd(int endProcessed) const {
+        if (indexMap.empty()) return 0;
+        return indexMap[std::min(std::max(endProcessed - 1, 0), (int)indexMap.size() - 1)] + 1;
+    }
 };
 
 struct MatchSpan {
@@ -108,250 +663,3679 @@ struct MatchSpan {
 	std::string textB;
 	int lineA;
 	int lineB;
+	// Offsets into the unprocessed text, filled in by finalizeSpans
+	int rawStartA = 0;
+	int rawEndA = 0;
+	int rawStartB = 0;
+	int rawEndB = 0;
+	int edits = 0;  // substituted, inserted or deleted characters absorbed with --max-edits
 };
 
-class CheckerBase {
+// Set by SIGINT / SIGTERM in one-shot modes; cancels every comparison in flight
+static std::atomic<bool> cancelAll{false};
+
+// Cooperative time budget for one comparison. Hot loops poll the token and, once its deadline
+// has passed or a cancel was requested, stop early; the pair is then reported with what was
+// found so far and flagged as truncated.
+class CancelToken {
+private:
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point deadline;
+	bool timed = false;
+	mutable std::atomic<bool> stopped{false};
+
 public:
-	virtual ~CheckerBase() = default;
-	virtual double score(const Document &a, const Document &b) = 0;
-	virtual std::vector<MatchSpan> matches() const { return {}; }
+	// Calls to poll() between two reads of the clock
+	static const unsigned pollInterval = 1024;
+
+	// Starts a new budget of `timeoutMs` milliseconds; 0 means no deadline
+	void start(int timeoutMs) {
+		timed = timeoutMs > 0;
+		if (timed) deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+		stopped.store(false, std::memory_order_relaxed);
+	}
+
+	bool expired() const {
+		if (stopped.load(std::memory_order_relaxed)) return true;
+		if (cancelAll.load(std::memory_order_relaxed) || (timed && Clock::now() >= deadline)) {
+			stopped.store(true, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+	// Check for tight loops: only looks at the clock once every pollInterval calls
+	bool poll(unsigned &tick) const {
+		if (stopped.load(std::memory_order_relaxed)) return true;
+		return ++tick % pollInterval == 0 && expired();
+	}
+
+	// True once a check has seen the budget run out; does not look at the clock itself
+	bool tripped() const { return stopped.load(std::memory_order_relaxed); }
+
+	static const CancelToken &unlimited() {
+		static const CancelToken token;
+		return token;
+	}
 };
 
-class RabinKarpChecker : public CheckerBase {
+// Bump allocator for scratch containers that live for one comparison. Memory is carved from
+// chunks that are kept across reset(), so once a worker has seen a few comparisons its hash maps
+// and temporary vectors stop touching the heap; deallocation is a no-op and reset() is O(1).
+// Chunks beyond `retainBytes` are returned to the heap on reset after an unusually large pair.
+class Arena : public std::pmr::memory_resource {
 private:
-	std::vector<MatchSpan> spans;
-	static const long long mod = 1000000007LL;
-	static const long long base = 257LL;
+	struct Chunk {
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+	std::vector<Chunk> chunks;
+	size_t current = 0;   // chunk being carved
+	size_t offset = 0;    // bytes used in chunks[current]
+	size_t used = 0;      // bytes handed out since the last reset, including alignment padding
+	size_t capacity = 0;
+	static const size_t minChunk = 64 << 10;
+	static const size_t retainBytes = (size_t)64 << 20;
 
-	std::vector<int> findOccurrences(const std::string &text, const std::string &pattern) {
-		std::vector<int> res;
-		int n = (int)text.size(), m = (int)pattern.size();
-		if (m == 0 || n < m) return res;
-		long long h = 1;
-		for (int i = 0; i < m - 1; ++i) h = (h * base) % mod;
-		long long p = 0, t = 0;
-		for (int i = 0; i < m; ++i) {
-			p = (p * base + (unsigned char)pattern[i]) % mod;
-			t = (t * base + (unsigned char)text[i]) % mod;
-		}
-		for (int i = 0; i <= n - m; ++i) {
-			if (p == t) {
-				bool eq = true;
-				for (int j = 0; j < m; ++j) {
-					if (text[i + j] != pattern[j]) { eq = false; break; }
+protected:
+	void *do_allocate(size_t bytes, size_t align) override {
+		allocations++;
+		for (;;) {
+			if (current < chunks.size()) {
+				size_t start = (offset + align - 1) & ~(align - 1);
+				if (start + bytes <= chunks[current].size) {
+					used += start + bytes - offset;
+					offset = start + bytes;
+					return chunks[current].data.get() + start;
+				}
+				if (current + 1 < chunks.size()) {
+					used += chunks[current].size - offset;
+					current++;
+					offset = 0;
+					continue;
 				}
-				if (eq) res.push_back(i);
-			}
-			if (i < n - m) {
-				t = (base * (t - (unsigned char)text[i] * h % mod + mod) % mod + (unsigned char)text[i + m]) % mod;
 			}
+			// No retained chunk fits; the rest of the current one is left unused
+			if (current < chunks.size()) used += chunks[current].size - offset;
+			size_t size = std::max({minChunk, chunks.empty() ? 0 : chunks.back().size * 2, bytes + align});
+			chunks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+			capacity += size;
+			chunkAllocations++;
+			current = chunks.size() - 1;
+			offset = 0;
 		}
-		return res;
 	}
 
+	void do_deallocate(void *, size_t, size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
 public:
-	double score(const Document &a, const Document &b) override {
-		spans.clear();
-		
-		// For identical files, return 100%
-        if (a.text == b.text) {
-            // Add a single span covering the entire text (raw slices)
-            spans.push_back({
-                0, (int)a.text.size(), 0, (int)b.text.size(),
-                a.rawSlice(0, (int)a.text.size()), b.rawSlice(0, (int)b.text.size()),
-                a.getLineNumber(0), b.getLineNumber(0)
-            });
-            return 100.0;
-        }
-		
-		// Choose a window size for substrings (e.g., 8 for better sensitivity with partial matches)
-		const int window = 8;
-		if ((int)a.text.size() < window || (int)b.text.size() < window) {
-			// For very short texts, do character-by-character comparison
-			int matches = 0;
-			int minLen = std::min((int)a.text.size(), (int)b.text.size());
-			for (int i = 0; i < minLen; ++i) {
-				if (a.text[i] == b.text[i]) matches++;
-			}
-			if (minLen > 0) {
-                spans.push_back({
-                    0, minLen, 0, minLen,
-                    a.rawSlice(0, minLen), b.rawSlice(0, minLen),
-                    a.getLineNumber(0), b.getLineNumber(0)
-                });
-                return (double)matches * 100.0 / (double)minLen;
-            }
-			return 0.0;
+	long long allocations = 0;       // requests served since construction
+	long long chunkAllocations = 0;  // of which reached the heap
+
+	// Every container built on the arena must be gone before this is called
+	void reset() {
+		while (capacity > retainBytes && chunks.size() > 1) {
+			capacity -= chunks.back().size;
+			chunks.pop_back();
 		}
-		
-		int total = 0;
-		int matched = 0;
-        // Use a sliding window with step size 4 for better performance while maintaining accuracy
-        auto merge_or_add = [&](int sA, int eA, int sB, int eB){
-            // try to merge with an existing span that overlaps on B
-            for (auto &sp : spans) {
-                bool overlapB = !(eB <= sp.startB || sB >= sp.endB);
-                bool overlapA = !(eA <= sp.startA || sA >= sp.endA);
-                if (overlapB && overlapA) {
-                    sp.startA = std::min(sp.startA, sA);
-                    sp.endA = std::max(sp.endA, eA);
-                    sp.startB = std::min(sp.startB, sB);
-                    sp.endB = std::max(sp.endB, eB);
-                    sp.textA = a.rawSlice(sp.startA, sp.endA);
-                    sp.textB = b.rawSlice(sp.startB, sp.endB);
-                    sp.lineA = a.getLineNumber(sp.startA);
-                    sp.lineB = b.getLineNumber(sp.startB);
-                    return;
-                }
-            }
-            spans.push_back({
-                sA, eA, sB, eB,
-                a.rawSlice(sA, eA),
-                b.rawSlice(sB, eB),
-                a.getLineNumber(sA),
-                b.getLineNumber(sB)
-            });
-        };
-
-        for (int i = 0; i + window <= (int)a.text.size(); i += 4) {
-            std::string pattern = a.text.substr(i, window);
-            auto occ = findOccurrences(b.text, pattern);
-            total++;
-            if (!occ.empty()) {
-                matched++;
-                for (int startB : occ) {
-                    int startA = i;
-                    int endA = i + window;
-                    int endB = startB + window;
-                    // Extend backwards
-                    while (startA > 0 && startB > 0 && a.text[startA - 1] == b.text[startB - 1]) {
-                        startA--; startB--;
-                    }
-                    // Extend forwards
-                    while (endA < (int)a.text.size() && endB < (int)b.text.size() && a.text[endA] == b.text[endB]) {
-                        endA++; endB++;
-                    }
-                    merge_or_add(startA, endA, startB, endB);
-                }
-            }
-        }
-		if (total == 0) return 0.0;
-		return (double)matched * 100.0 / (double)total;
+		current = 0;
+		offset = 0;
+		used = 0;
 	}
 
-	std::vector<MatchSpan> matches() const override { return spans; }
+	size_t bytesUsed() const { return used; }
+	size_t bytesReserved() const { return capacity; }
 };
 
-class JaccardChecker : public CheckerBase {
+// Allocation counters summed over the arenas of a worker
+struct ArenaCounts {
+	long long allocations = 0;
+	long long chunkAllocations = 0;
+
+	void add(const Arena &arena) {
+		allocations += arena.allocations;
+		chunkAllocations += arena.chunkAllocations;
+	}
+};
+
+// Per-comparison resource limits, set once per run from the command line; 0 means unlimited
+struct CompareLimits {
+	int timeoutMs = 0;       // time budget per pair
+	int maxOccurrences = 0;  // k-grams occurring more often than this in B are not extended
+	int maxSpans = 0;        // candidate spans (and paragraph runs) recorded per pair
+	int maxEdits = 0;        // edits a Rabin-Karp span may absorb while extending; 0 keeps spans exact
+};
+
+// How often a comparison ran into its CompareLimits
+struct LimitStats {
+	long long skippedKeys = 0;   // probed windows whose k-gram was over maxOccurrences
+	long long droppedSpans = 0;  // candidates not recorded because maxSpans was reached
+
+	bool hit() const { return skippedKeys > 0 || droppedSpans > 0; }
+	void add(const LimitStats &o) {
+		skippedKeys += o.skippedKeys;
+		droppedSpans += o.droppedSpans;
+	}
+};
+
+// Monotonic clock for --stats phase timings
+static long long monotonicNs() {
+	return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Peak resident set of the process in bytes, or 0 where it is not available
+static long long peakRssBytes() {
+#ifdef _WIN32
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;
+#else
+	return (long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Chrome trace-event recorder behind --trace. Every thread appends complete ("X") events to its
+// own ring buffer without locking; a buffer that fills up overwrites its oldest events and counts
+// them as dropped. The buffers are written out once, at exit, as a JSON trace that Perfetto and
+// chrome://tracing open directly. Tracing is off while `tracer` is null and every hook is then a
+// single pointer test.
+class TraceRecorder {
+public:
+	struct Event {
+		const char *name;
+		const char *argName;  // nullptr when the event has no argument
+		long long startNs;
+		long long durNs;
+		long long arg;
+	};
+
 private:
-	std::unordered_set<std::string> shinglesA;
-	std::unordered_set<std::string> shinglesB;
+	struct Buffer {
+		int tid;
+		std::string label;
+		std::vector<Event> events;
+		size_t next = 0;  // slot overwritten next once the ring is full
+		long long dropped = 0;
+	};
+	std::mutex m;
+	std::vector<std::unique_ptr<Buffer>> buffers;
+	std::thread::id mainThread;
+	long long originNs;
+	size_t capacity;
 
-	static std::vector<std::string> makeShingles(const std::string &s, int k) {
-		std::vector<std::string> res;
-		if ((int)s.size() < k) return res;
-		for (int i = 0; i + k <= (int)s.size(); ++i) {
-			res.push_back(s.substr(i, k));
+	Buffer &local() {
+		thread_local Buffer *buffer = nullptr;
+		thread_local const TraceRecorder *owner = nullptr;
+		if (owner != this) {
+			// First event of this thread: the only time the recorder lock is taken
+			std::lock_guard<std::mutex> lock(m);
+			buffers.emplace_back(new Buffer());
+			buffer = buffers.back().get();
+			buffer->tid = (int)buffers.size();
+			buffer->label = std::this_thread::get_id() == mainThread ? "main" : "thread " + std::to_string(buffer->tid);
+			owner = this;
 		}
-		return res;
+		return *buffer;
 	}
 
 public:
-	double score(const Document &a, const Document &b) override {
-		// For identical files, return 100%
-		if (a.text == b.text) {
-			return 100.0;
+	// Events kept per thread before the oldest are overwritten
+	static const size_t defaultCapacity = 1 << 16;
+
+	explicit TraceRecorder(size_t eventsPerThread = defaultCapacity)
+		: mainThread(std::this_thread::get_id()), originNs(monotonicNs()), capacity(std::max<size_t>(eventsPerThread, 1)) {}
+
+	// Names the calling thread in the trace, e.g. "worker 3"
+	void nameThread(const std::string &label) { local().label = label; }
+
+	void record(const char *name, long long startNs, long long endNs, const char *argName = nullptr, long long arg = 0) {
+		Buffer &b = local();
+		Event e{name, argName, startNs, endNs - startNs, arg};
+		if (b.events.size() < capacity) {
+			b.events.push_back(e);
+		} else {
+			b.events[b.next] = e;
+			b.next = (b.next + 1) % capacity;
+			b.dropped++;
 		}
-		
-		shinglesA.clear();
-		shinglesB.clear();
-		// Using smaller shingle size (3) for better sensitivity to partial matches
-		const int k = 3;
-		for (const auto &sh : makeShingles(Document::toLower(a.text), k)) shinglesA.insert(sh);
-		for (const auto &sh : makeShingles(Document::toLower(b.text), k)) shinglesB.insert(sh);
-		if (shinglesA.empty() && shinglesB.empty()) return 100.0;
-		if (shinglesA.empty() || shinglesB.empty()) return 0.0;
-		int inter = 0;
-		for (const auto &sh : shinglesA) {
-			if (shinglesB.find(sh) != shinglesB.end()) inter++;
-		}
-		double uni = (double)(shinglesA.size() + shinglesB.size() - inter);
-		
-		// Calculate similarity score
-		double similarity = (double)inter * 100.0 / uni;
-		
-		// Apply a scaling factor to make partial matches more pronounced
-		// This helps prevent the algorithm from showing 0% for partial matches
-		if (similarity > 0 && similarity < 20) {
-			similarity = 20 + (similarity * 0.8);
+	}
+
+	// Call once every traced thread has finished
+	bool write(const std::string &path) {
+		std::lock_guard<std::mutex> lock(m);
+		std::ofstream out(path, std::ios::binary);
+		if (!out) return false;
+		long long dropped = 0;
+		bool first = true;
+		out << "{\"traceEvents\":[";
+		char ts[64];
+		for (const auto &b : buffers) {
+			dropped += b->dropped;
+			out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"args\":{\"name\":\"" << b->label << "\"}}";
+			first = false;
+			for (const Event &e : b->events) {
+				// Microseconds with nanosecond precision, as the format expects
+				std::snprintf(ts, sizeof ts, "%.3f,\"dur\":%.3f", (e.startNs - originNs) / 1e3, e.durNs / 1e3);
+				out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"cpp_checker\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+					<< ",\"ts\":" << ts;
+				if (e.argName) out << ",\"args\":{\"" << e.argName << "\":" << e.arg << "}";
+				out << "}";
+			}
 		}
-		
-		return similarity;
+		out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+		return (bool)out;
 	}
 };
 
-static std::string jsonEscape(const std::string &s) {
-	std::string out;
-	out.reserve(s.size());
-	for (char c : s) {
-		if (c == '"') out += "\\\"";
-		else if (c == '\\') out += "\\\\";
-		else if (c == '\n') out += "\\n";
-		else out += c;
+static TraceRecorder *tracer = nullptr;
+
+// Records the enclosing scope as one trace event when tracing is on
+class TraceScope {
+private:
+	const char *name;
+	const char *argName;
+	long long arg;
+	long long started;
+
+public:
+	explicit TraceScope(const char *eventName, const char *argumentName = nullptr, long long argument = 0)
+		: name(eventName), argName(argumentName), arg(argument), started(tracer ? monotonicNs() : 0) {}
+	~TraceScope() {
+		if (tracer) tracer->record(name, started, monotonicNs(), argName, arg);
 	}
-	return out;
-}
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+};
 
-int main(int argc, char *argv[]) {
-	if (argc < 3) {
-		std::cerr << "Usage: cpp_checker <file1> <file2>" << std::endl;
-		return 1;
+// Phase timings and work counters of one RabinKarpChecker::score call, filled only under --stats
+struct RabinKarpStats {
+	long long indexNs = 0, probeNs = 0, mergeNs = 0;
+	long long windowsProbed = 0;   // windows of A looked up in the index of B
+	long long windowHits = 0;      // windows found in B (over-frequent ones included)
+	long long verifyFailures = 0;  // index chain entries in the right bucket with a different k-gram
+	long long occurrences = 0;     // positions in B visited for the hits
+	long long diagonalSkips = 0;   // occurrences already covered by an extended run
+	long long extensions = 0;      // runs extended around a hit
+	long long candidates = 0;      // distinct runs left to merge
+	long long spans = 0;           // spans after merging
+
+	void add(const RabinKarpStats &o) {
+		windowsProbed += o.windowsProbed;
+		windowHits += o.windowHits;
+		verifyFailures += o.verifyFailures;
+		occurrences += o.occurrences;
+		diagonalSkips += o.diagonalSkips;
+		extensions += o.extensions;
 	}
-	std::string file1 = argv[1];
-	std::string file2 = argv[2];
-	Document a = Document::fromFile(file1);
-	Document b = Document::fromFile(file2);
+};
 
-	RabinKarpChecker rk;
-	double rkScore = rk.score(a, b);
-	JaccardChecker jc;
-	double jcScore = jc.score(a, b);
+class CheckerBase {
+public:
+	virtual ~CheckerBase() = default;
+	virtual double score(const Document &a, const Document &b) = 0;
+	virtual std::vector<MatchSpan> matches() const { return {}; }
+};
 
-	// Always combine both algorithms for a more accurate score
-	double localScore;
-	// If files are identical, keep 100% score
-	if (a.text == b.text) {
-		localScore = 100.0;
-	} 
-	// If files are completely different, keep 0% score
-	else if (rkScore == 0 && jcScore == 0) {
-		localScore = 0.0;
+// Read-only index of every window of B keyed by its rolling hash. With base 256 modulo 2^64 the
+// hash of an 8-byte window is the window itself, so equal keys never need a byte comparison.
+// Positions are chained through `next` in ascending order, matching a left-to-right scan of B.
+class WindowIndex {
+private:
+	const std::string *text = nullptr;
+	int window = 0;
+	std::vector<int> head;
+	std::vector<int> next;
+	uint64_t mask = 0;
+
+	static uint64_t bucketOf(uint64_t key) {
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return key;
 	}
-	// For partial matches, combine both algorithms with higher weight to Jaccard
-	else {
-		// Jaccard is better at detecting partial similarity, so give it more weight
-		localScore = 0.4 * rkScore + 0.6 * jcScore;
+
+public:
+	static uint64_t keyAt(const std::string &s, int pos, int window) {
+		uint64_t key = 0;
+		for (int j = 0; j < window; ++j) key = (key << 8) | (unsigned char)s[pos + j];
+		return key;
 	}
 
-    // Build JSON with matches from RK
-    std::ostringstream out;
-    out << "{\"localScore\":" << localScore << ",";
-    out << "\"rabinKarpScore\":" << rkScore << ",";
-    out << "\"jaccardScore\":" << jcScore << ",";
-    out << "\"matches\":[";
-	auto spans = rk.matches();
-	for (size_t i = 0; i < spans.size(); ++i) {
-		const auto &sp = spans[i];
-		out << "{\"startA\":" << sp.startA << ",\"endA\":" << sp.endA
-			<< ",\"startB\":" << sp.startB << ",\"endB\":" << sp.endB
-			<< ",\"textA\":\"" << jsonEscape(sp.textA) << "\""
-			<< ",\"textB\":\"" << jsonEscape(sp.textB) << "\""
-			<< ",\"lineA\":" << sp.lineA << ",\"lineB\":" << sp.lineB << "}";
-		if (i + 1 < spans.size()) out << ",";
+	void build(const std::string &s, int w) {
+		text = &s;
+		window = w;
+		int n = (int)s.size() - w + 1;
+		size_t buckets = 1;
+		while ((int)buckets < std::max(n / 2, 1)) buckets <<= 1;
+		mask = buckets - 1;
+		head.assign(buckets, -1);
+		next.assign(std::max(n, 0), -1);
+		if (n <= 0) return;
+		// Insert right to left so each chain lists positions in ascending order
+		uint64_t key = keyAt(s, n - 1, w);
+		for (int j = n - 1; j >= 0; --j) {
+			if (j < n - 1) key = (key >> 8) | ((uint64_t)(unsigned char)s[j] << (8 * (w - 1)));
+			int &h = head[bucketOf(key) & mask];
+			next[j] = h;
+			h = j;
+		}
 	}
-	out << "]}";
 
-	std::cout << out.str() << std::endl;
-	return 0;
+private:
+	template <bool Counting>
+	bool find(uint64_t key, std::vector<int> &res, int limit, long long *rejected) const {
+		res.clear();
+		if (head.empty()) return true;
+		for (int j = head[bucketOf(key) & mask]; j >= 0; j = next[j]) {
+			if (keyAt(*text, j, window) != key) {
+				if (Counting) ++*rejected;
+				continue;
+			}
+			if (limit > 0 && (int)res.size() == limit) {
+				res.clear();
+				return false;
+			}
+			res.push_back(j);
+		}
+		return true;
+	}
+
+public:
+	// Appends every position in the indexed text whose window equals `key`. With a positive
+	// `limit`, a key occurring more often than that is given up on as soon as the limit is
+	// passed: `res` is left empty and false is returned.
+	bool findOccurrences(uint64_t key, std::vector<int> &res, int limit = 0) const {
+		return find<false>(key, res, limit, nullptr);
+	}
+
+	// Same lookup, also adding to `rejected` the chain entries whose k-gram differs from `key`
+	bool findOccurrences(uint64_t key, std::vector<int> &res, int limit, long long &rejected) const {
+		return find<true>(key, res, limit, &rejected);
+	}
+
+	size_t bytes() const { return (head.capacity() + next.capacity()) * sizeof(int); }
+};
+
+// Merges each run into the first earlier span that overlaps it on both A and B. Runs must arrive
+// by increasing startA, so a span whose endA is behind the current start can never be merged
+// into again and is dropped from the active set.
+template <class Run>
+static void mergeRuns(const std::vector<Run> &runs, std::vector<MatchSpan> &spans) {
+	std::vector<int> active;
+	for (const auto &c : runs) {
+		active.erase(std::remove_if(active.begin(), active.end(), [&](int k) { return spans[k].endA <= c.startA; }), active.end());
+		bool absorbed = false;
+		for (int k : active) {
+			auto &sp = spans[k];
+			bool overlapB = !(c.endB <= sp.startB || c.startB >= sp.endB);
+			bool overlapA = !(c.endA <= sp.startA || c.startA >= sp.endA);
+			if (overlapB && overlapA) {
+				sp.startA = std::min(sp.startA, c.startA);
+				sp.endA = std::max(sp.endA, c.endA);
+				sp.startB = std::min(sp.startB, c.startB);
+				sp.endB = std::max(sp.endB, c.endB);
+				sp.edits = std::max(sp.edits, c.edits);
+				absorbed = true;
+				break;
+			}
+		}
+		if (!absorbed) {
+			active.push_back((int)spans.size());
+			spans.push_back({c.startA, c.endA, c.startB, c.endB, std::string(), std::string(), 0, 0});
+			spans.back().edits = c.edits;
+		}
+	}
 }
 
+// Longest common subsequence length, bit-parallel (Allison-Dix, Hyyro): one bit per character
+// of the shorter string, 64 to a word, so each character of the longer string costs one add, and,
+// or per word. V keeps a 0 bit at every row where the LCS of the prefixes grew; since U = V & M
+// is a subset of V, V - U needs no borrow and only the addition carries between words.
+class BitParallelLcs {
+private:
+	std::vector<uint64_t> peq;  // per byte value, the rows of the pattern holding it
+	std::vector<uint64_t> v;
+	std::vector<uint8_t> table; // alignedRange's LCS counts
+	std::vector<std::pair<int, int>> matched;
+
+public:
+	// Returns -1 if `cancel` expired before the end
+	int length(const char *a, int la, const char *b, int lb, const CancelToken &cancel = CancelToken::unlimited()) {
+		if (la > lb) {
+			std::swap(a, b);
+			std::swap(la, lb);
+		}
+		if (la == 0) return 0;
+		const int words = (la + 63) / 64;
+		peq.assign((size_t)256 * words, 0);
+		for (int i = 0; i < la; ++i) peq[(size_t)(unsigned char)a[i] * words + (i >> 6)] |= 1ULL << (i & 63);
+		v.assign(words, ~0ULL);
+		uint64_t *vp = v.data();
+		unsigned tick = 0;
+		if (words == 1) {
+			uint64_t x = ~0ULL;
+			for (int j = 0; j < lb; ++j) {
+				uint64_t u = x & peq[(unsigned char)b[j]];
+				x = (x + u) | (x - u);
+			}
+			vp[0] = x;
+		} else {
+			for (int j = 0; j < lb; ++j) {
+				if (cancel.poll(tick)) return -1;
+				const uint64_t *m = &peq[(size_t)(unsigned char)b[j] * words];
+				uint64_t carry = 0;
+				for (int w = 0; w < words; ++w) {
+					uint64_t x = vp[w], u = x & m[w];
+					uint64_t sum = x + u;
+					uint64_t c1 = sum < x;
+					sum += carry;
+					carry = c1 | (sum < carry);
+					vp[w] = sum | (x - u);
+				}
+			}
+		}
+		int lcs = 0;
+		for (int w = 0; w < words; ++w) {
+			uint64_t zeros = ~vp[w];
+			if (w == words - 1 && (la & 63)) zeros &= (1ULL << (la & 63)) - 1;
+			lcs += popcount64(zeros);
+		}
+		return lcs;
+	}
+
+	// 2 * LCS / (la + lb), the share of both strings an optimal alignment matches
+	double ratio(const char *a, int la, const char *b, int lb, const CancelToken &cancel = CancelToken::unlimited()) {
+		if (la + lb == 0) return 1.0;
+		int lcs = length(a, la, b, lb, cancel);
+		return lcs < 0 ? -1.0 : 2.0 * lcs / (la + lb);
+	}
+
+	// Range of a and of b from the first to the last character of a longest common subsequence,
+	// as [startA, endA) and [startB, endB), leaving out whitespace matched at either end; empty
+	// ranges if nothing else matches. The alignment keeps its characters as early in b as possible.
+	// Fills an O(la * lb) table of counts, so it is meant for texts where one side is short (below
+	// 256 characters).
+	void alignedRange(const char *a, int la, const char *b, int lb, int &startA, int &endA, int &startB, int &endB) {
+		startA = endA = startB = endB = 0;
+		if (la == 0 || lb == 0 || std::min(la, lb) > 255) return;
+		const int cols = lb + 1;
+		table.assign((size_t)(la + 1) * cols, 0);
+		for (int i = 1; i <= la; ++i) {
+			uint8_t *row = &table[(size_t)i * cols];
+			const uint8_t *up = row - cols;
+			for (int j = 1; j <= lb; ++j) {
+				row[j] = a[i - 1] == b[j - 1] ? (uint8_t)(up[j - 1] + 1) : std::max(up[j], row[j - 1]);
+			}
+		}
+		auto at = [&](int i, int j) { return table[(size_t)i * cols + j]; };
+		matched.clear();
+		for (int i = la, j = lb; i > 0 && j > 0;) {
+			if (at(i, j - 1) == at(i, j)) {
+				--j;
+			} else if (at(i - 1, j) == at(i, j)) {
+				--i;
+			} else {
+				--i;
+				--j;
+				if (!std::isspace((unsigned char)a[i])) matched.push_back({i, j});
+			}
+		}
+		if (matched.empty()) return;
+		startA = matched.back().first;
+		startB = matched.back().second;
+		endA = matched.front().first + 1;
+		endB = matched.front().second + 1;
+	}
+
+	size_t bytes() const {
+		return (peq.capacity() + v.capacity()) * sizeof(uint64_t) + table.capacity() + matched.capacity() * sizeof(std::pair<int, int>);
+	}
+};
+
+// Length of the common prefix of s[i..] and t[j..], at most `limit`. Compares 16 bytes per step
+// where SSE2 is available.
+static int commonRun(const std::string &s, int i, const std::string &t, int j, int limit) {
+	int n = std::min({limit, (int)s.size() - i, (int)t.size() - j});
+	int k = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+	for (; k + 16 <= n; k += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.data() + i + k));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(t.data() + j + k));
+		unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+		if (diff) return k + ctz64(diff);
+	}
+#endif
+	while (k < n && s[i + k] == t[j + k]) ++k;
+	return k;
+}
+
+// Length of the common suffix of s[..i) and t[..j), at most `limit`
+static int commonRunBack(const std::string &s, int i, const std::string &t, int j, int limit) {
+	int n = std::min({limit, i, j});
+	int k = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+	for (; k + 16 <= n; k += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.data() + i - k - 16));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(t.data() + j - k - 16));
+		unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+		if (diff) return k + 15 - highBit32(diff);
+	}
+#endif
+	while (k < n && s[i - 1 - k] == t[j - 1 - k]) ++k;
+	return k;
+}
+
+// Span extension through small edits (--max-edits), a banded X-drop alignment. Where an exact run
+// ends, an edit-distance DP is run over the next `rows` characters of A against B, restricted to
+// diagonals within `band` of the current one. Substitutions, insertions and deletions cost one edit
+// each. The 15 diagonals of a row fit the 16 byte lanes of an SSE2 register: substitutions and
+// deletions are one saturating add and min per row, and the insertion chain along the row is a
+// prefix minimum in four shifted steps. The same byte compares give a match bitmask per row, so the
+// cells starting an exact run of at least `anchor` characters are found with a few ANDs. The
+// alignment resumes at the cheapest of them (earliest in A on ties), costing at most
+// xDrop / editPenalty edits. The score gains one per matched character and loses editPenalty per
+// edit. Extension stops when no cell qualifies, the edit budget is spent, or the score falls more
+// than xDrop below the best seen. The span then ends after the best-scoring run, never on an edit.
+// Only exact runs of at least minSeed characters are extended this way; shorter ones are mostly
+// chance k-gram hits.
+class EditExtender {
+public:
+	static const int minSeed = 24;
+	static const int band = 7;
+	static const int rows = 32;
+	static const int anchor = 8;
+	static const int editPenalty = 3;
+	static const int xDrop = 24;
+
+private:
+	static const int lanes = 16;  // 2 * band + 1 diagonals and one unused lane
+	static const unsigned char unreachable = 255;
+
+	// D[x][k]: edits to align x characters of `a` with x + k - band characters of `b`, where
+	// b[t] is the character of B on diagonal t - band of A's first character. Bytes of b that lie
+	// outside B are flagged in `outside` and never match. Bit k of eq[x] is set when a[x] equals
+	// the next character of B on diagonal k - band.
+	static void align(const unsigned char *a, int count, const unsigned char *b, const unsigned char *outside,
+			unsigned char (*d)[lanes], unsigned *eq) {
+		for (int k = 0; k < lanes; ++k) d[0][k] = k >= band && k < 2 * band + 1 ? (unsigned char)(k - band) : unreachable;
+#if defined(__SSE2__) || defined(_M_X64)
+		const __m128i one = _mm_set1_epi8(1);
+		const __m128i lastLane = _mm_srli_si128(_mm_set1_epi8((char)-1), lanes - 1 - 2 * band);
+		const __m128i pad = _mm_slli_si128(_mm_set1_epi8((char)-1), 2 * band + 1);
+		__m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d[0]));
+		for (int x = 1; x <= count; ++x) {
+			__m128i bx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x - 1));
+			__m128i out = _mm_loadu_si128(reinterpret_cast<const __m128i *>(outside + x - 1));
+			__m128i same = _mm_andnot_si128(out, _mm_cmpeq_epi8(bx, _mm_set1_epi8((char)a[x - 1])));
+			eq[x - 1] = (unsigned)_mm_movemask_epi8(same);
+			__m128i differs = _mm_andnot_si128(same, one);
+			__m128i sub = _mm_adds_epu8(prev, differs);
+			__m128i del = _mm_adds_epu8(_mm_or_si128(_mm_srli_si128(prev, 1), _mm_andnot_si128(lastLane, pad)), one);
+			__m128i cur = _mm_min_epu8(sub, del);
+			// Insertions: lane k may come from lane k - s at s more edits
+			cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 1), _mm_srli_si128(_mm_set1_epi8((char)-1), 15)), _mm_set1_epi8(1)));
+			cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 2), _mm_srli_si128(_mm_set1_epi8((char)-1), 14)), _mm_set1_epi8(2)));
+			cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 4), _mm_srli_si128(_mm_set1_epi8((char)-1), 12)), _mm_set1_epi8(4)));
+			cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 8), _mm_srli_si128(_mm_set1_epi8((char)-1), 8)), _mm_set1_epi8(8)));
+			cur = _mm_or_si128(cur, pad);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(d[x]), cur);
+			prev = cur;
+		}
+#else
+		auto add = [](unsigned char v, int n) { return (unsigned char)std::min(255, v + n); };
+		for (int x = 1; x <= count; ++x) {
+			eq[x - 1] = 0;
+			for (int k = 0; k < lanes; ++k) {
+				if (k > 2 * band) {
+					d[x][k] = unreachable;
+					continue;
+				}
+				bool same = !outside[x - 1 + k] && b[x - 1 + k] == a[x - 1];
+				if (same) eq[x - 1] |= 1u << k;
+				unsigned char sub = add(d[x - 1][k], same ? 0 : 1);
+				unsigned char del = add(k + 1 <= 2 * band ? d[x - 1][k + 1] : unreachable, 1);
+				unsigned char ins = add(k > 0 ? d[x][k - 1] : unreachable, 1);
+				d[x][k] = std::min({sub, del, ins});
+			}
+		}
+#endif
+	}
+
+public:
+	// Moves (posA, posB), the end of an exact run (its start when Backward), through edits and
+	// returns the edits taken. visit(endA, endB) is called after every run crossed forwards.
+	template <bool Backward, class Visit>
+	static int extend(const std::string &ta, int &posA, const std::string &tb, int &posB, int budget, Visit visit) {
+		auto run = [&](int i, int j, int limit) {
+			return Backward ? commonRunBack(ta, i, tb, j, limit) : commonRun(ta, i, tb, j, limit);
+		};
+		const int dir = Backward ? -1 : 1;
+		const int sizeA = (int)ta.size(), sizeB = (int)tb.size();
+		// Characters ahead of (i, j) in the direction of extension, A's and B's shifted by -band
+		auto charA = [&](int i, int x) { return (unsigned char)ta[Backward ? i - 1 - x : i + x]; };
+		auto posOfB = [&](int j, int t) { return Backward ? j - 1 - (t - band) : j + (t - band); };
+		unsigned char a[rows], b[rows + lanes], outside[rows + lanes];
+		unsigned char d[rows + 1][lanes];
+		unsigned eq[rows];
+		int i = posA, j = posB;
+		int score = 0, best = 0, edits = 0, bestEdits = 0;
+		while (edits < budget) {
+			int count = std::min(rows, Backward ? i : sizeA - i);
+			if (count == 0) break;
+			for (int x = 0; x < count; ++x) a[x] = charA(i, x);
+			for (int t = 0; t < count + lanes - 1; ++t) {
+				int p = posOfB(j, t);
+				bool in = p >= 0 && p < sizeB;
+				b[t] = in ? (unsigned char)tb[p] : 0;
+				outside[t] = in ? 0 : 1;
+			}
+			align(a, count, b, outside, d, eq);
+			// Cheapest cell that resumes an exact run, earliest in A. Runs reaching past the
+			// window are checked on the texts.
+			const int cap = std::min(budget - edits, xDrop / editPenalty);
+			int stepA = -1, stepB = -1, cost = cap + 1;
+			for (int x = 0; x <= count; ++x) {
+				unsigned starts = (1u << (2 * band + 1)) - 1;
+				bool inWindow = x + anchor <= count;
+				for (int r = 0; inWindow && r < anchor; ++r) starts &= eq[x + r];
+				while (starts) {
+					int k = ctz64(starts);
+					starts &= starts - 1;
+					int c = d[x][k], y = x + k - band;
+					if (c == 0 || c >= cost || y < 0 || (Backward ? j - y < 0 : j + y > sizeB)) continue;
+					if (!inWindow && run(i + dir * x, j + dir * y, anchor) < anchor) continue;
+					stepA = x;
+					stepB = y;
+					cost = c;
+				}
+			}
+			if (stepA < 0) break;
+			i += dir * stepA;
+			j += dir * stepB;
+			edits += cost;
+			int r = run(i, j, INT32_MAX);
+			i += dir * r;
+			j += dir * r;
+			score += r - editPenalty * cost;
+			if (!Backward) visit(i, j);
+			if (score > best) {
+				best = score;
+				bestEdits = edits;
+				posA = i;
+				posB = j;
+			} else if (best - score > xDrop) {
+				break;
+			}
+		}
+		return bestEdits;
+	}
+};
+
+class RabinKarpChecker : public CheckerBase {
+private:
+	std::vector<MatchSpan> spans;
+	int threads = 1;
+	// A's windows are probed in chunks of at least this many, whatever the thread count, so the
+	// candidates found (and where the span cap cuts them) do not depend on how many threads run
+	static const int chunkWindows = 1 << 15;
+
+	struct Candidate {
+		int startA, endA, startB, endB;
+		int edits = 0;
+		bool operator<(const Candidate &o) const {
+			if (startA != o.startA) return startA < o.startA;
+			if (startB != o.startB) return startB < o.startB;
+			if (endA != o.endA) return endA < o.endA;
+			return endB < o.endB;
+		}
+		bool operator==(const Candidate &o) const {
+			return startA == o.startA && startB == o.startB && endA == o.endA && endB == o.endB;
+		}
+	};
+
+	// Per-thread probe state; reused across calls so a checker owned by a worker does not reallocate
+	struct Partition {
+		std::vector<int> occ;
+		std::vector<std::pair<int, int>> crossed; // run ends passed by the current edit extension
+		Arena arena; // backs the per-probe diagonal map
+	};
+	// What probing one chunk of A found
+	struct Chunk {
+		int total = 0;
+		int matched = 0;
+		LimitStats limits;
+		RabinKarpStats counts; // only filled by probe<true>
+		std::vector<Candidate> candidates;
+	};
+	WindowIndex indexB;
+	BitParallelLcs lcs; // short texts
+	std::vector<Partition> partitions;
+	std::vector<Chunk> chunks;
+	std::vector<Candidate> merged;
+	const CancelToken *cancel = &CancelToken::unlimited();
+	CompareLimits limits;
+	LimitStats limitStats;
+	RabinKarpStats *stats = nullptr;
+
+	// Probes windows of A starting in [from, to) against the index of B and records the maximal
+	// exact run around every hit. Runs are only extended once per diagonal. The counting
+	// instantiation also fills out.counts; the default one compiles the counters out. At most
+	// maxSpans candidates are recorded per chunk; score() applies the cap across chunks.
+	template <bool Counting>
+	void probe(const Document &a, const Document &b, int from, int to, Partition &part, Chunk &out) const {
+		out.total = 0;
+		out.matched = 0;
+		out.limits = LimitStats();
+		if (Counting) out.counts = RabinKarpStats();
+		out.candidates.clear();
+		part.arena.reset();
+		std::pmr::unordered_map<int, int> diagonalEnd(&part.arena); // startB - startA -> furthest endA already extended
+		const std::string &ta = a.text;
+		const std::string &tb = b.text;
+		unsigned tick = 0;
+		for (int i = from; i < to; i += step) {
+			if (cancel->poll(tick)) break;
+			uint64_t key = WindowIndex::keyAt(ta, i, window);
+			bool complete = Counting ? indexB.findOccurrences(key, part.occ, limits.maxOccurrences, out.counts.verifyFailures)
+				: indexB.findOccurrences(key, part.occ, limits.maxOccurrences);
+			out.total++;
+			if (!complete) {
+				// Over-frequent k-grams still count as matched but are not extended
+				out.matched++;
+				out.limits.skippedKeys++;
+				continue;
+			}
+			if (part.occ.empty()) continue;
+			out.matched++;
+			if (Counting) out.counts.occurrences += (long long)part.occ.size();
+			for (int startB : part.occ) {
+				if (cancel->poll(tick)) break;
+				int startA = i;
+				auto it = diagonalEnd.find(startB - startA);
+				if (it != diagonalEnd.end() && it->second >= startA + window) {
+					if (Counting) out.counts.diagonalSkips++;
+					continue;
+				}
+				if (limits.maxSpans > 0 && (int)out.candidates.size() >= limits.maxSpans) {
+					out.limits.droppedSpans++;
+					continue;
+				}
+				int endA = i + window;
+				int endB = startB + window;
+				// Extend backwards, then forwards
+				int back = commonRunBack(ta, startA, tb, startB, INT32_MAX);
+				startA -= back;
+				startB -= back;
+				int ahead = commonRun(ta, endA, tb, endB, INT32_MAX);
+				endA += ahead;
+				endB += ahead;
+				diagonalEnd[startB - startA] = endA;
+				int edits = 0;
+				if (limits.maxEdits > 0 && endA - startA >= EditExtender::minSeed) {
+					part.crossed.clear();
+					edits = EditExtender::extend<false>(ta, endA, tb, endB, limits.maxEdits,
+						[&](int runEndA, int runEndB) { part.crossed.push_back({runEndA, runEndB}); });
+					// Runs the span crossed cover their diagonals too, so later hits on them are skipped
+					for (const auto &run : part.crossed) {
+						if (run.first <= endA) diagonalEnd[run.second - run.first] = run.first;
+					}
+					edits += EditExtender::extend<true>(ta, startA, tb, startB, limits.maxEdits - edits, [](int, int) {});
+				}
+				out.candidates.push_back({startA, endA, startB, endB, edits});
+			}
+		}
+		if (Counting) {
+			out.counts.windowsProbed = out.total;
+			out.counts.windowHits = out.matched;
+			out.counts.extensions = (long long)out.candidates.size();
+		}
+	}
+
+	void probeRange(const Document &a, const Document &b, int from, int to, Partition &part, Chunk &out) const {
+		if (stats) probe<true>(a, b, from, to, part, out);
+		else probe<false>(a, b, from, to, part, out);
+	}
+
+public:
+	// Window size for substrings (8 gives good sensitivity with partial matches)
+	static const int window = 8;
+	// Sliding step over A; 4 keeps performance while maintaining accuracy
+	static const int step = 4;
+
+	// Number of threads used to probe a single pair; only large documents are split
+	void setThreads(int n) { threads = std::max(1, n); }
+
+	// Token polled while probing; a cancelled score and its spans cover only the windows probed
+	void setCancel(const CancelToken &token) { cancel = &token; }
+
+	// Occurrence and span caps for the following comparisons; score() reports hits in limitsHit()
+	void setLimits(const CompareLimits &l) { limits = l; }
+	const LimitStats &limitsHit() const { return limitStats; }
+
+	// Where score() records its phase timings and counters; nullptr (the default) records nothing
+	void setStats(RabinKarpStats *s) { stats = s; }
+
+	void addArenaCounts(ArenaCounts &counts) const {
+		for (const auto &part : partitions) counts.add(part.arena);
+	}
+
+	// Bytes held by the index and probe buffers, which keep their capacity between comparisons
+	size_t scratchBytes() const {
+		size_t n = indexB.bytes() + lcs.bytes() + merged.capacity() * sizeof(Candidate) + spans.capacity() * sizeof(MatchSpan);
+		for (const auto &part : partitions) n += part.occ.capacity() * sizeof(int) + part.arena.bytesReserved();
+		for (const auto &chunk : chunks) n += chunk.candidates.capacity() * sizeof(Candidate);
+		return n;
+	}
+
+	double score(const Document &a, const Document &b) override {
+		spans.clear();
+		limitStats = LimitStats();
+		if (stats) *stats = RabinKarpStats();
+		
+		// For identical files, return 100%
+        if (a.text == b.text) {
+            // Add a single span covering the entire text
+            spans.push_back({
+                0, (int)a.text.size(), 0, (int)b.text.size(), std::string(), std::string(),
+                a.getLineNumber(0), b.getLineNumber(0)
+            });
+            return 100.0;
+        }
+		
+		if ((int)a.text.size() < window || (int)b.text.size() < window) {
+			// Too short for a window: score the longest common subsequence, which unlike a
+			// positional comparison survives insertions and deletions, and report the range it spans
+			int la = (int)a.text.size(), lb = (int)b.text.size();
+			int common = la && lb ? lcs.length(a.text.data(), la, b.text.data(), lb, *cancel) : 0;
+			if (common <= 0) return 0.0;
+			int startA, endA, startB, endB;
+			lcs.alignedRange(a.text.data(), la, b.text.data(), lb, startA, endA, startB, endB);
+			if (endA > startA) {
+				spans.push_back({
+					startA, endA, startB, endB, std::string(), std::string(),
+					a.getLineNumber(startA), b.getLineNumber(startB)
+				});
+			}
+			return 2.0 * common * 100.0 / (double)(la + lb);
+		}
+		
+		bool timed = stats || tracer;
+		long long started = timed ? monotonicNs() : 0;
+		indexB.build(b.text, window);
+		long long indexed = timed ? monotonicNs() : 0;
+
+		// Split A's windows into contiguous, step-aligned chunks; threads take chunks in turn
+		int windows = ((int)a.text.size() - window) / step + 1;
+		int chunkCount = std::max(1, windows / chunkWindows);
+		int parts = std::min(threads, chunkCount);
+		if ((int)partitions.size() < parts) partitions.resize(parts);
+		if ((int)chunks.size() < chunkCount) chunks.resize(chunkCount);
+		int lastStart = (int)a.text.size() - window;
+		auto chunkStart = [&](int c) { return (int)((long long)windows * c / chunkCount) * step; };
+		auto probeChunk = [&](int c, Partition &part) {
+			int to = c + 1 < chunkCount ? chunkStart(c + 1) : lastStart + 1;
+			probeRange(a, b, chunkStart(c), to, part, chunks[c]);
+		};
+		if (parts == 1) {
+			for (int c = 0; c < chunkCount; ++c) probeChunk(c, partitions[0]);
+		} else {
+			std::atomic<int> next{0};
+			std::vector<std::thread> workers;
+			for (int p = 0; p < parts; ++p) {
+				workers.emplace_back([&, p] {
+					if (tracer) tracer->nameThread("rk probe");
+					for (int c; (c = next.fetch_add(1)) < chunkCount;) {
+						TraceScope span("rkProbePartition", "partition", c);
+						probeChunk(c, partitions[p]);
+					}
+				});
+			}
+			for (auto &t : workers) t.join();
+		}
+		long long probed = timed ? monotonicNs() : 0;
+
+		// Combine the chunks in order of A, keeping the first maxSpans candidates, then sort them
+		// canonically; neither step depends on how many threads probed
+		int total = 0;
+		int matched = 0;
+		merged.clear();
+		for (int c = 0; c < chunkCount; ++c) {
+			const Chunk &chunk = chunks[c];
+			total += chunk.total;
+			matched += chunk.matched;
+			limitStats.add(chunk.limits);
+			if (stats) stats->add(chunk.counts);
+			size_t keep = chunk.candidates.size();
+			if (limits.maxSpans > 0) keep = std::min(keep, (size_t)limits.maxSpans - std::min(merged.size(), (size_t)limits.maxSpans));
+			limitStats.droppedSpans += (long long)(chunk.candidates.size() - keep);
+			merged.insert(merged.end(), chunk.candidates.begin(), chunk.candidates.begin() + keep);
+		}
+		std::sort(merged.begin(), merged.end());
+		merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+
+		mergeRuns(merged, spans);
+		for (auto &sp : spans) {
+			sp.lineA = a.getLineNumber(sp.startA);
+			sp.lineB = b.getLineNumber(sp.startB);
+		}
+		if (timed) {
+			long long mergedAt = monotonicNs();
+			if (tracer) {
+				tracer->record("rkIndex", started, indexed);
+				tracer->record("rkProbe", indexed, probed, "windows", total);
+				tracer->record("rkMerge", probed, mergedAt, "candidates", (long long)merged.size());
+			}
+			if (stats) {
+				stats->candidates = (long long)merged.size();
+				stats->spans = (long long)spans.size();
+				stats->indexNs = indexed - started;
+				stats->probeNs = probed - indexed;
+				stats->mergeNs = mergedAt - probed;
+			}
+		}
+		if (total == 0) return 0.0;
+		return (double)matched * 100.0 / (double)total;
+	}
+
+	// Spans in processed-text coordinates; slices and raw offsets are filled in by finalizeSpans
+	std::vector<MatchSpan> matches() const override { return spans; }
+};
+
+// Rabin-Karp over the token stream of the word mode. Every n-gram of B's tokens is indexed by its
+// polynomial hash, hits are verified token by token and extended to maximal runs of equal
+// tokens, so a copied passage matches however its words were spaced, cased or punctuated.
+// Spans are reported in processed-text coordinates, like RabinKarpChecker's.
+class TokenRabinKarpChecker : public CheckerBase {
+private:
+	struct Run {
+		int startA, endA, startB, endB;
+		int edits = 0;
+		bool operator<(const Run &o) const {
+			if (startA != o.startA) return startA < o.startA;
+			if (startB != o.startB) return startB < o.startB;
+			if (endA != o.endA) return endA < o.endA;
+			return endB < o.endB;
+		}
+		bool operator==(const Run &o) const {
+			return startA == o.startA && startB == o.startB && endA == o.endA && endB == o.endB;
+		}
+	};
+
+	std::vector<MatchSpan> spans;
+	std::vector<uint64_t> gramsA;
+	std::vector<uint64_t> gramsB;
+	std::vector<int> head;
+	std::vector<int> next;
+	std::vector<int> occ;
+	std::vector<Run> runs;
+	std::unordered_map<int, int> diagonalEnd; // startB - startA -> furthest endA already extended
+	const CancelToken *cancel = &CancelToken::unlimited();
+	CompareLimits limits;
+	LimitStats limitStats;
+	RabinKarpStats *stats = nullptr;
+
+	static uint64_t bucketOf(uint64_t key) {
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return key;
+	}
+
+public:
+	// Tokens per n-gram. Four words rarely repeat by chance in prose; normalised code needs longer
+	// n-grams, since every identifier and literal looks the same.
+	static int ngramFor(TokenMode mode) { return mode == TokenMode::code ? 12 : 4; }
+
+	// Hash of every n-gram of `t`, by start position
+	static void gramHashes(const std::vector<uint32_t> &t, int n, std::vector<uint64_t> &res) {
+		const uint64_t base = 0x100000001b3ULL;
+		res.clear();
+		if ((int)t.size() < n) return;
+		uint64_t top = 1; // base^(n-1)
+		for (int j = 1; j < n; ++j) top *= base;
+		uint64_t h = 0;
+		for (int j = 0; j < n; ++j) h = h * base + t[j] + 1;
+		res.reserve(t.size() - n + 1);
+		res.push_back(h);
+		for (size_t i = n; i < t.size(); ++i) {
+			h = (h - (t[i - n] + 1) * top) * base + t[i] + 1;
+			res.push_back(h);
+		}
+	}
+
+	void setCancel(const CancelToken &token) { cancel = &token; }
+	void setLimits(const CompareLimits &l) { limits = l; }
+	const LimitStats &limitsHit() const { return limitStats; }
+	void setStats(RabinKarpStats *s) { stats = s; }
+
+	size_t scratchBytes() const {
+		return (gramsA.capacity() + gramsB.capacity()) * sizeof(uint64_t) + (head.capacity() + next.capacity() + occ.capacity()) * sizeof(int)
+			+ runs.capacity() * sizeof(Run) + spans.capacity() * sizeof(MatchSpan);
+	}
+
+	double score(const Document &a, const Document &b) override {
+		spans.clear();
+		limitStats = LimitStats();
+		if (stats) *stats = RabinKarpStats();
+
+		if (a.text == b.text) {
+			spans.push_back({
+				0, (int)a.text.size(), 0, (int)b.text.size(), std::string(), std::string(),
+				a.getLineNumber(0), b.getLineNumber(0)
+			});
+			return 100.0;
+		}
+		const std::vector<uint32_t> &ta = a.tokens;
+		const std::vector<uint32_t> &tb = b.tokens;
+		// Streams shorter than an n-gram are compared as one n-gram of their common length
+		const int n = std::min(ngramFor(a.tokenMode), (int)std::min(ta.size(), tb.size()));
+		if (n == 0) return 0.0;
+
+		bool timed = stats || tracer;
+		long long started = timed ? monotonicNs() : 0;
+		gramHashes(tb, n, gramsB);
+		int countB = (int)gramsB.size();
+		size_t buckets = 1;
+		while ((int)buckets < std::max(countB / 2, 1)) buckets <<= 1;
+		head.assign(buckets, -1);
+		next.assign(countB, -1);
+		// Insert right to left so each chain lists positions in ascending order
+		for (int j = countB - 1; j >= 0; --j) {
+			int &h = head[bucketOf(gramsB[j]) & (buckets - 1)];
+			next[j] = h;
+			h = j;
+		}
+		gramHashes(ta, n, gramsA);
+		long long indexed = timed ? monotonicNs() : 0;
+
+		int total = 0;
+		int matched = 0;
+		runs.clear();
+		diagonalEnd.clear();
+		unsigned tick = 0;
+		long long verifyFailures = 0, occurrences = 0, diagonalSkips = 0;
+		for (int i = 0; i < (int)gramsA.size(); ++i) {
+			if (cancel->poll(tick)) break;
+			total++;
+			uint64_t key = gramsA[i];
+			occ.clear();
+			bool complete = true;
+			for (int j = head[bucketOf(key) & (buckets - 1)]; j >= 0; j = next[j]) {
+				if (gramsB[j] != key || !std::equal(ta.begin() + i, ta.begin() + i + n, tb.begin() + j)) {
+					verifyFailures++;
+					continue;
+				}
+				if (limits.maxOccurrences > 0 && (int)occ.size() == limits.maxOccurrences) {
+					complete = false;
+					break;
+				}
+				occ.push_back(j);
+			}
+			if (!complete) {
+				// Over-frequent n-grams still count as matched but are not extended
+				matched++;
+				limitStats.skippedKeys++;
+				continue;
+			}
+			if (occ.empty()) continue;
+			matched++;
+			occurrences += (long long)occ.size();
+			for (int j : occ) {
+				if (cancel->poll(tick)) break;
+				int startA = i, startB = j;
+				auto it = diagonalEnd.find(startB - startA);
+				if (it != diagonalEnd.end() && it->second >= startA + n) {
+					diagonalSkips++;
+					continue;
+				}
+				if (limits.maxSpans > 0 && (int)runs.size() >= limits.maxSpans) {
+					limitStats.droppedSpans++;
+					continue;
+				}
+				int endA = startA + n, endB = startB + n;
+				while (startA > 0 && startB > 0 && ta[startA - 1] == tb[startB - 1]) {
+					startA--; startB--;
+				}
+				while (endA < (int)ta.size() && endB < (int)tb.size() && ta[endA] == tb[endB]) {
+					endA++; endB++;
+				}
+				diagonalEnd[startB - startA] = endA;
+				runs.push_back({startA, endA, startB, endB});
+			}
+		}
+		long long probed = timed ? monotonicNs() : 0;
+
+		std::sort(runs.begin(), runs.end());
+		runs.erase(std::unique(runs.begin(), runs.end()), runs.end());
+		long long extensions = (long long)runs.size();
+		// Token runs become processed-text ranges from the first token's start to the last one's end
+		for (auto &c : runs) {
+			c = {a.tokenStart[c.startA], a.tokenEnd[c.endA - 1], b.tokenStart[c.startB], b.tokenEnd[c.endB - 1]};
+		}
+		mergeRuns(runs, spans);
+		for (auto &sp : spans) {
+			sp.lineA = a.getLineNumber(sp.startA);
+			sp.lineB = b.getLineNumber(sp.startB);
+		}
+		if (timed) {
+			long long mergedAt = monotonicNs();
+			if (tracer) {
+				tracer->record("rkIndex", started, indexed);
+				tracer->record("rkProbe", indexed, probed, "windows", total);
+				tracer->record("rkMerge", probed, mergedAt, "candidates", extensions);
+			}
+			if (stats) {
+				stats->indexNs = indexed - started;
+				stats->probeNs = probed - indexed;
+				stats->mergeNs = mergedAt - probed;
+				stats->windowsProbed = total;
+				stats->windowHits = matched;
+				stats->verifyFailures = verifyFailures;
+				stats->occurrences = occurrences;
+				stats->diagonalSkips = diagonalSkips;
+				stats->extensions = extensions;
+				stats->candidates = extensions;
+				stats->spans = (long long)spans.size();
+			}
+		}
+		if (total == 0) return 0.0;
+		return (double)matched * 100.0 / (double)total;
+	}
+
+	std::vector<MatchSpan> matches() const override { return spans; }
+};
+
+class JaccardChecker : public CheckerBase {
+private:
+	std::vector<uint64_t> shinglesA;
+	std::vector<uint64_t> shinglesB;
+
+public:
+	// Using smaller shingle size (3) for better sensitivity to partial matches
+	static const int k = 3;
+
+	// Distinct shingles of `s`, each packed into an integer (lossless for k <= 4), sorted
+	static void makeShingles(const std::string &s, std::vector<uint64_t> &res) {
+		res.clear();
+		if ((int)s.size() < k) return;
+		res.reserve(s.size());
+		uint32_t key = 0;
+		for (int i = 0; i < (int)s.size(); ++i) {
+			key = (key << 8) | (unsigned char)s[i];
+			if (i + 1 >= k) res.push_back(k == 4 ? key : key & ((1u << (8 * k)) - 1));
+		}
+		std::sort(res.begin(), res.end());
+		res.erase(std::unique(res.begin(), res.end()), res.end());
+	}
+
+	// Tokens per shingle in the token modes; code tokens are far less distinctive than words
+	static int tokenShingleSize(TokenMode mode) { return mode == TokenMode::code ? 6 : k; }
+
+	// Distinct shingles of consecutive tokens, hashed to 64 bits so collisions stay negligible
+	// even across large batches. Words are hashed from their text rather than their vocabulary ids
+	// so the sets (and cached results) do not depend on the order words were seen; code token ids
+	// are fixed and used as they are.
+	static void makeTokenShingles(const Document &d, std::vector<uint64_t> &res) {
+		res.clear();
+		const int size = tokenShingleSize(d.tokenMode);
+		int count = (int)d.tokens.size();
+		if (count < size) return;
+		std::vector<uint64_t> words(d.tokens.begin(), d.tokens.end());
+		if (d.tokenMode == TokenMode::words) {
+			for (int i = 0; i < count; ++i) {
+				uint64_t h = 14695981039346656037ULL;
+				for (int c = d.tokenStart[i]; c < d.tokenEnd[i]; ++c) h = (h ^ (unsigned char)d.text[c]) * 1099511628211ULL;
+				words[i] = h;
+			}
+		}
+		res.reserve(count);
+		for (int i = 0; i + size <= count; ++i) {
+			uint64_t h = 0;
+			for (int j = 0; j < size; ++j) h = (h ^ words[i + j]) * 0x9e3779b97f4a7c15ULL;
+			res.push_back(h);
+		}
+		std::sort(res.begin(), res.end());
+		res.erase(std::unique(res.begin(), res.end()), res.end());
+	}
+
+	// Character or token shingles, depending on how `d` was tokenized
+	static void shinglesOf(const Document &d, std::vector<uint64_t> &res) {
+		if (d.tokenMode == TokenMode::chars) makeShingles(d.text, res);
+		else makeTokenShingles(d, res);
+	}
+
+	// Apply a scaling factor to make partial matches more pronounced
+	// This helps prevent the algorithm from showing 0% for partial matches
+	static double scaleSimilarity(double similarity) {
+		if (similarity > 0 && similarity < 20) {
+			similarity = 20 + (similarity * 0.8);
+		}
+		return similarity;
+	}
+
+	// Scaled Jaccard similarity of two shingle sets produced by makeShingles
+	static double similarity(const std::vector<uint64_t> &sa, const std::vector<uint64_t> &sb) {
+		if (sa.empty() && sb.empty()) return 100.0;
+		if (sa.empty() || sb.empty()) return 0.0;
+		size_t inter = 0;
+		auto x = sa.begin(), y = sb.begin();
+		while (x != sa.end() && y != sb.end()) {
+			if (*x < *y) ++x;
+			else if (*y < *x) ++y;
+			else { ++inter; ++x; ++y; }
+		}
+		double uni = (double)(sa.size() + sb.size() - inter);
+		
+		// Calculate similarity score
+		double similarity = (double)inter * 100.0 / uni;
+		
+		return scaleSimilarity(similarity);
+	}
+
+	double score(const Document &a, const Document &b) override {
+		// For identical files, return 100%
+		if (a.text == b.text) {
+			return 100.0;
+		}
+		
+		// Document text is already lowercased by preprocess
+		shinglesOf(a, shinglesA);
+		shinglesOf(b, shinglesB);
+		return similarity(shinglesA, shinglesB);
+	}
+
+	// Shingle set sizes from the last score() call that built the sets
+	size_t shingleCountA() const { return shinglesA.size(); }
+	size_t shingleCountB() const { return shinglesB.size(); }
+
+	// Same as score() with shingle sets that were computed (and cached) earlier
+	double score(const Document &a, const Document &b, const std::vector<uint64_t> &sa, const std::vector<uint64_t> &sb) {
+		if (a.text == b.text) return 100.0;
+		return similarity(sa, sb);
+	}
+};
+
+// Writes [p, p + n) as the body of a JSON string, without building a copy; runs that
+// need no escaping are written in one piece
+static void writeJsonEscaped(std::ostream &out, const char *p, size_t n) {
+	size_t run = 0;
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char c = (unsigned char)p[i];
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+		out.write(p + run, (std::streamsize)(i - run));
+		run = i + 1;
+		if (c == '"') out << "\\\"";
+		else if (c == '\\') out << "\\\\";
+		else if (c == '\n') out << "\\n";
+		else if (c == '\r') out << "\\r";
+		else if (c == '\t') out << "\\t";
+		else {
+			static const char digits[] = "0123456789abcdef";
+			char esc[6] = {'\\', 'u', '0', '0', digits[c >> 4], digits[c & 0xf]};
+			out.write(esc, 6);
+		}
+	}
+	out.write(p + run, (std::streamsize)(n - run));
+}
+
+[[maybe_unused]] static std::string jsonEscape(const std::string &s) {
+	std::ostringstream out;
+	writeJsonEscaped(out, s.data(), s.size());
+	return out.str();
+}
+
+// Turns checker spans into the final highlight set: every span is re-extended to its maximal
+// exact run, spans starting inside the B range already covered are folded into the previous
+// one, and neighbours on the same lines at most 4 characters apart are merged. Raw offsets and
+// slices are filled in from the index maps.
+static void finalizeSpans(const Document &a, const Document &b, std::vector<MatchSpan> &spans) {
+	const std::string &ta = a.text;
+	const std::string &tb = b.text;
+	auto setRaw = [&](MatchSpan &sp) {
+		sp.rawStartA = a.rawStart(sp.startA);
+		sp.rawEndA = a.rawEnd(sp.endA);
+		sp.rawStartB = b.rawStart(sp.startB);
+		sp.rawEndB = b.rawEnd(sp.endB);
+	};
+
+	std::stable_sort(spans.begin(), spans.end(), [](const MatchSpan &x, const MatchSpan &y) { return x.startB < y.startB; });
+	std::vector<MatchSpan> extended;
+	extended.reserve(spans.size());
+	int lastEndB = -1;
+	for (auto &m : spans) {
+		int sa = m.startA, sb = m.startB, ea = m.endA, eb = m.endB;
+		// Backward extend
+		while (sa > 0 && sb > 0 && ta[sa - 1] == tb[sb - 1]) {
+			sa--; sb--;
+		}
+		// Forward extend
+		while (ea < (int)ta.size() && eb < (int)tb.size() && ta[ea] == tb[eb]) {
+			ea++; eb++;
+		}
+		// Deduplicate overlapping on B; only a span that also continues the last one in A
+		// extends it, otherwise the A range would be stretched over unrelated text
+		if (lastEndB >= 0 && sb <= lastEndB) {
+			if (!extended.empty()) {
+				auto &last = extended.back();
+				if (eb > last.endB && sa >= last.startA && sa <= last.endA) {
+					last.endA = std::max(last.endA, ea);
+					last.endB = eb;
+					last.edits = std::max(last.edits, m.edits);
+					setRaw(last);
+				}
+			}
+			continue;
+		}
+		MatchSpan sp = m;
+		sp.startA = sa; sp.endA = ea; sp.startB = sb; sp.endB = eb;
+		setRaw(sp);
+		extended.push_back(std::move(sp));
+		lastEndB = std::max(lastEndB, eb);
+	}
+
+	std::stable_sort(extended.begin(), extended.end(), [](const MatchSpan &x, const MatchSpan &y) {
+		if (x.lineB != y.lineB) return x.lineB < y.lineB;
+		return x.startB < y.startB;
+	});
+	spans.clear();
+	for (auto &m : extended) {
+		if (!spans.empty()) {
+			auto &prev = spans.back();
+			bool sameLines = prev.lineA == m.lineA && prev.lineB == m.lineB;
+			// A must continue forward too; a neighbour that jumps back in A would stretch the
+			// merged A range over everything in between
+			bool close = m.startB <= prev.endB + 4 && m.startA >= prev.startA && m.startA <= prev.endA + 4;
+			if (sameLines && close) {
+				prev.endB = std::max(prev.endB, m.endB);
+				prev.endA = std::max(prev.endA, m.endA);
+				prev.rawStartA = std::min(prev.rawStartA, m.rawStartA);
+				prev.rawEndA = std::max(prev.rawEndA, m.rawEndA);
+				prev.rawStartB = std::min(prev.rawStartB, m.rawStartB);
+				prev.rawEndB = std::max(prev.rawEndB, m.rawEndB);
+				prev.edits += m.edits;
+				continue;
+			}
+		}
+		spans.push_back(std::move(m));
+	}
+	for (auto &sp : spans) {
+		// Byte-level matches may end inside a multi-byte character
+		sp.rawStartA = a.charStart(sp.rawStartA);
+		sp.rawEndA = a.charEnd(sp.rawEndA);
+		sp.rawStartB = b.charStart(sp.rawStartB);
+		sp.rawEndB = b.charEnd(sp.rawEndB);
+		sp.textA = a.raw.substr(sp.rawStartA, std::max(0, sp.rawEndA - sp.rawStartA));
+		sp.textB = b.raw.substr(sp.rawStartB, std::max(0, sp.rawEndB - sp.rawStartB));
+	}
+}
+
+// A highlight in raw text coordinates, as forwarded by the service
+struct Highlight {
+	int rawStartA = 0;
+	int rawEndA = 0;
+	int rawStartB = 0;
+	int rawEndB = 0;
+	int lineStartA = 0;
+	int lineEndA = 0;
+	int lineStartB = 0;
+	int lineEndB = 0;
+	int lineA = 0;            // line the highlight is shown on
+	int lineB = 0;
+	int lineTextStartA = -1;  // raw range of that line without its break, or -1 if not reported
+	int lineTextEndA = -1;
+	int lineTextStartB = -1;
+	int lineTextEndB = -1;
+	int edits = 0;            // edits of the span the highlight comes from (--max-edits)
+	const char *matchType = "";
+};
+
+// Finds sentences (split after . ! ? and whitespace, at least 8 characters) that occur verbatim
+// in both documents after per-line normalisation (line breaks dropped, whitespace collapsed,
+// lowercased). Every sentence is normalised and hashed once and A is joined to B through a hash
+// table, instead of comparing every sentence of A with every sentence of B.
+class SentenceMatcher {
+public:
+	static const int minLength = 8;
+
+private:
+	struct Sentence {
+		int line;       // 1-based real line number
+		int start;      // offset into `norm`
+		int length;
+		uint64_t hash;
+	};
+	// Normalised text of one document; sentences never cross lines, so lines are simply appended
+	struct Normalized {
+		std::string norm;
+		std::vector<int> map; // norm offset -> raw offset
+		std::vector<Sentence> sentences;
+	};
+	Normalized na, nb;
+	Arena arena; // backs the per-call sentence index and seen set
+	CompareLimits limits;
+	LimitStats limitStats;
+
+	static uint64_t hashBytes(const char *p, int len) {
+		uint64_t h = 1469598103934665603ULL;
+		for (int i = 0; i < len; ++i) {
+			h ^= (unsigned char)p[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	static void normalize(const std::string &raw, const std::vector<int> &lineStarts, Normalized &out) {
+		out.norm.clear();
+		out.map.clear();
+		out.sentences.clear();
+		for (size_t l = 0; l < lineStarts.size(); ++l) {
+			int from = lineStarts[l];
+			int to = l + 1 < lineStarts.size() ? lineStarts[l + 1] : (int)raw.size();
+			int lineBegin = (int)out.norm.size();
+			bool lastSpace = false;
+			for (int i = from; i < to; ++i) {
+				unsigned char c = (unsigned char)raw[i];
+				if (c == '\r' || c == '\n') continue;
+				if (isTextSpace(c)) {
+					if (!lastSpace) {
+						out.norm += ' ';
+						out.map.push_back(i);
+						lastSpace = true;
+					}
+				} else {
+					out.norm += (char)std::tolower(c);
+					out.map.push_back(i);
+					lastSpace = false;
+				}
+			}
+			// Split into sentences at whitespace preceded by . ! or ?; the collapsed whitespace
+			// is a single space, which also trims every sentence
+			int lineEnd = (int)out.norm.size();
+			int start = lineBegin;
+			for (int i = lineBegin; i <= lineEnd; ++i) {
+				bool boundary = i == lineEnd
+					|| (out.norm[i] == ' ' && i > lineBegin && (out.norm[i - 1] == '.' || out.norm[i - 1] == '!' || out.norm[i - 1] == '?'));
+				if (!boundary) continue;
+				int s = start, e = i;
+				while (s < e && out.norm[s] == ' ') ++s;
+				while (e > s && out.norm[e - 1] == ' ') --e;
+				if (e > s) out.sentences.push_back({(int)l + 1, s, e - s, hashBytes(out.norm.data() + s, e - s)});
+				start = i + 1;
+			}
+		}
+	}
+
+public:
+	// A sentence repeated on many lines matches every line pair, so maxSpans also caps the matches
+	void setLimits(const CompareLimits &l) { limits = l; }
+	const LimitStats &limitsHit() const { return limitStats; }
+
+	size_t scratchBytes() const {
+		size_t n = 0;
+		for (const Normalized *d : {&na, &nb}) {
+			n += d->norm.capacity() + d->map.capacity() * sizeof(int) + d->sentences.capacity() * sizeof(Sentence);
+		}
+		return n + arena.bytesReserved();
+	}
+
+	void addArenaCounts(ArenaCounts &counts) const { counts.add(arena); }
+
+	void match(const Document &a, const Document &b, const CancelToken &cancel, std::vector<Highlight> &out) {
+		out.clear();
+		limitStats = LimitStats();
+		normalize(a.raw, a.rawLines, na);
+		normalize(b.raw, b.rawLines, nb);
+		arena.reset();
+		// Sentence hash -> indices into nb.sentences
+		std::pmr::unordered_map<uint64_t, std::pmr::vector<int>> indexB(&arena);
+		for (int k = 0; k < (int)nb.sentences.size(); ++k) indexB[nb.sentences[k].hash].push_back(k);
+
+		// Each (line of A, line of B, sentence) is reported once, at its first occurrence
+		std::pmr::unordered_set<uint64_t> seen(&arena);
+		unsigned tick = 0;
+		for (const auto &sa : na.sentences) {
+			if (cancel.poll(tick)) break;
+			if (sa.length < minLength) continue;
+			auto it = indexB.find(sa.hash);
+			if (it == indexB.end()) continue;
+			for (int k : it->second) {
+				if (cancel.poll(tick)) break;
+				const auto &sb = nb.sentences[k];
+				if (sb.length != sa.length || nb.norm.compare(sb.start, sb.length, na.norm, sa.start, sa.length) != 0) continue;
+				uint64_t pairKey = (((uint64_t)sa.line * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)sb.line << 32)) ^ sa.hash;
+				if (seen.count(pairKey)) continue;
+				if (limits.maxSpans > 0 && (int)out.size() >= limits.maxSpans) {
+					limitStats.droppedSpans++;
+					continue;
+				}
+				seen.insert(pairKey);
+				Highlight h;
+				h.rawStartA = na.map[sa.start];
+				h.rawEndA = na.map[sa.start + sa.length - 1] + 1;
+				h.rawStartB = nb.map[sb.start];
+				h.rawEndB = nb.map[sb.start + sb.length - 1] + 1;
+				h.lineStartA = a.lineOf(h.rawStartA);
+				h.lineEndA = a.lineOf(std::max(h.rawEndA - 1, h.rawStartA));
+				h.lineStartB = b.lineOf(h.rawStartB);
+				h.lineEndB = b.lineOf(std::max(h.rawEndB - 1, h.rawStartB));
+				h.lineA = h.lineStartA;
+				h.lineB = h.lineStartB;
+				h.matchType = "sentence";
+				out.push_back(h);
+			}
+		}
+	}
+};
+
+// Aligns paragraphs of A and B (blocks separated by blank lines) on the raw text and reports
+// equal runs of at least 20 characters, replacing difflib.SequenceMatcher over every paragraph
+// pair. Runs are found from 8-byte anchors sampled in A and probed in an index of B, extended
+// within the two paragraphs, and then chosen longest-first without crossing, as difflib's
+// matching blocks are. Runs of one A paragraph separated by at most 10 non-alphanumeric
+// characters on both sides are merged.
+class ParagraphAligner {
+public:
+	static const int minRun = 20;
+	static const int maxNoiseGap = 10;
+
+private:
+	static const int anchor = 8;
+	// Any run of minRun characters contains a sampled anchor that fits entirely inside it
+	static const int sampleStep = minRun - anchor + 1;
+
+	struct Run {
+		int pa, pb;
+		int a0, b0, len;
+	};
+	struct Block {
+		int a0, b0, len;
+	};
+	WindowIndex index;
+	std::vector<int> occ;
+	std::vector<Run> runs;
+	Arena arena; // backs the per-call diagonal map and paragraph buffers
+	CompareLimits limits;
+	LimitStats limitStats;
+
+	static int paragraphOf(const std::vector<std::pair<int, int>> &paras, int pos) {
+		auto it = std::upper_bound(paras.begin(), paras.end(), pos, [](int p, const std::pair<int, int> &x) { return p < x.first; });
+		return (int)(it - paras.begin()) - 1;
+	}
+
+	static bool isNoise(const std::string &raw, int from, int to) {
+		for (int i = from; i < to; ++i) {
+			if (std::isalnum((unsigned char)raw[i])) return false;
+		}
+		return true;
+	}
+
+	// difflib-style matching blocks of one paragraph pair from its maximal equal runs: take the
+	// longest run inside the current ranges (earliest on ties), then recurse left and right of it
+	static void matchingBlocks(const std::pmr::vector<Run> &pairRuns, int alo, int ahi, int blo, int bhi, const CancelToken &cancel,
+			std::pmr::vector<Block> &out) {
+		struct Range { int alo, ahi, blo, bhi; };
+		std::pmr::vector<Range> stack({{alo, ahi, blo, bhi}}, out.get_allocator());
+		while (!stack.empty() && !cancel.expired()) {
+			Range r = stack.back();
+			stack.pop_back();
+			Block best{0, 0, 0};
+			for (const auto &run : pairRuns) {
+				int t0 = std::max({0, r.alo - run.a0, r.blo - run.b0});
+				int t1 = std::min({run.len, r.ahi - run.a0, r.bhi - run.b0});
+				int len = t1 - t0;
+				if (len <= 0) continue;
+				Block cand{run.a0 + t0, run.b0 + t0, len};
+				if (len > best.len || (len == best.len && (cand.a0 < best.a0 || (cand.a0 == best.a0 && cand.b0 < best.b0)))) best = cand;
+			}
+			if (best.len < minRun) continue;
+			out.push_back(best);
+			stack.push_back({r.alo, best.a0, r.blo, best.b0});
+			stack.push_back({best.a0 + best.len, r.ahi, best.b0 + best.len, r.bhi});
+		}
+		std::sort(out.begin(), out.end(), [](const Block &x, const Block &y) { return x.a0 < y.a0; });
+	}
+
+public:
+	// Anchors over maxOccurrences in B are not extended and at most maxSpans runs are collected
+	void setLimits(const CompareLimits &l) { limits = l; }
+	const LimitStats &limitsHit() const { return limitStats; }
+
+	size_t scratchBytes() const {
+		return index.bytes() + occ.capacity() * sizeof(int) + runs.capacity() * sizeof(Run) + arena.bytesReserved();
+	}
+
+	void addArenaCounts(ArenaCounts &counts) const { counts.add(arena); }
+
+	void align(const Document &a, const Document &b, const CancelToken &cancel, std::vector<Highlight> &out) {
+		out.clear();
+		limitStats = LimitStats();
+		const std::string &ra = a.raw;
+		const std::string &rb = b.raw;
+		if ((int)ra.size() < minRun || (int)rb.size() < minRun) return;
+		const auto &parasA = a.rawParagraphs;
+		const auto &parasB = b.rawParagraphs;
+		auto hasText = [](const std::string &raw, const std::pair<int, int> &p) {
+			for (int i = p.first; i < p.second; ++i) {
+				if (!isTextSpace((unsigned char)raw[i])) return true;
+			}
+			return false;
+		};
+		arena.reset();
+		std::pmr::vector<char> textA(parasA.size(), &arena), textB(parasB.size(), &arena);
+		for (size_t i = 0; i < parasA.size(); ++i) textA[i] = hasText(ra, parasA[i]);
+		for (size_t i = 0; i < parasB.size(); ++i) textB[i] = hasText(rb, parasB[i]);
+
+		// Collect maximal equal runs, each bounded by the paragraphs it starts in
+		index.build(rb, anchor);
+		runs.clear();
+		std::pmr::unordered_map<long long, int> diagonalEnd(&arena); // (pb, diagonal) -> end of the last run in A
+		int pa = 0;
+		unsigned tick = 0;
+		for (int i = 0; i + anchor <= (int)ra.size(); i += sampleStep) {
+			if (cancel.poll(tick)) break;
+			while (pa + 1 < (int)parasA.size() && parasA[pa + 1].first <= i) ++pa;
+			if (!textA[pa]) continue;
+			int paEnd = parasA[pa].second;
+			if (i + anchor > paEnd) continue;
+			if (!index.findOccurrences(WindowIndex::keyAt(ra, i, anchor), occ, limits.maxOccurrences)) {
+				limitStats.skippedKeys++;
+				continue;
+			}
+			for (int j : occ) {
+				if (cancel.poll(tick)) break;
+				int pb = paragraphOf(parasB, j);
+				if (!textB[pb] || j + anchor > parasB[pb].second) continue;
+				long long diagKey = ((long long)pb << 32) ^ (unsigned)(j - i);
+				auto it = diagonalEnd.find(diagKey);
+				if (it != diagonalEnd.end() && it->second >= i + anchor) continue;
+				int a0 = i, b0 = j;
+				while (a0 > parasA[pa].first && b0 > parasB[pb].first && ra[a0 - 1] == rb[b0 - 1]) {
+					a0--; b0--;
+				}
+				int a1 = i + anchor, b1 = j + anchor;
+				while (a1 < paEnd && b1 < parasB[pb].second && ra[a1] == rb[b1]) {
+					a1++; b1++;
+				}
+				diagonalEnd[diagKey] = a1;
+				if (a1 - a0 < minRun) continue;
+				if (limits.maxSpans > 0 && (int)runs.size() >= limits.maxSpans) {
+					limitStats.droppedSpans++;
+					continue;
+				}
+				runs.push_back({pa, pb, a0, b0, a1 - a0});
+			}
+		}
+		std::sort(runs.begin(), runs.end(), [](const Run &x, const Run &y) {
+			if (x.pa != y.pa) return x.pa < y.pa;
+			if (x.pb != y.pb) return x.pb < y.pb;
+			return x.a0 < y.a0;
+		});
+
+		// Per paragraph of A, walk paragraphs of B in order and merge runs across noise gaps
+		struct Segment {
+			int a0, a1, b0, b1;
+		};
+		std::pmr::vector<Run> pairRuns(&arena);
+		std::pmr::vector<Block> blocks(&arena);
+		std::pmr::vector<Segment> merged(&arena);
+		size_t r = 0;
+		while (r < runs.size() && !cancel.expired()) {
+			int curA = runs[r].pa;
+			merged.clear();
+			while (r < runs.size() && runs[r].pa == curA) {
+				int curB = runs[r].pb;
+				pairRuns.clear();
+				while (r < runs.size() && runs[r].pa == curA && runs[r].pb == curB) pairRuns.push_back(runs[r++]);
+				blocks.clear();
+				matchingBlocks(pairRuns, parasA[curA].first, parasA[curA].second, parasB[curB].first, parasB[curB].second, cancel, blocks);
+				for (const auto &blk : blocks) {
+					Segment seg{blk.a0, blk.a0 + blk.len, blk.b0, blk.b0 + blk.len};
+					if (!merged.empty()) {
+						auto &last = merged.back();
+						int gapA = seg.a0 - last.a1, gapB = seg.b0 - last.b1;
+						if (gapA <= maxNoiseGap && gapB <= maxNoiseGap && isNoise(ra, last.a1, seg.a0) && isNoise(rb, last.b1, seg.b0)) {
+							last.a1 = seg.a1;
+							last.b1 = seg.b1;
+							continue;
+						}
+					}
+					merged.push_back(seg);
+				}
+			}
+			for (const auto &seg : merged) {
+				Highlight h;
+				h.rawStartA = seg.a0;
+				h.rawEndA = seg.a1;
+				h.rawStartB = seg.b0;
+				h.rawEndB = seg.b1;
+				h.lineStartA = a.lineOf(seg.a0);
+				h.lineEndA = a.lineOf(std::max(seg.a1 - 1, seg.a0));
+				h.lineStartB = b.lineOf(seg.b0);
+				h.lineEndB = b.lineOf(std::max(seg.b1 - 1, seg.b0));
+				h.matchType = "paragraph";
+				out.push_back(h);
+			}
+		}
+	}
+};
+
+// Suffix automaton over a byte range. Finds the longest block shared with another range in
+// linear time, breaking ties like difflib (earliest in the first range, then in the second).
+class SuffixAutomaton {
+	struct State {
+		int len, link, firstEnd, edges;
+	};
+	struct Edge {
+		unsigned char c;
+		int to, next;
+	};
+	std::vector<State> st;
+	std::vector<Edge> edges;
+	int base = 0;
+
+	int *target(int v, unsigned char c) {
+		for (int e = st[v].edges; e >= 0; e = edges[e].next) {
+			if (edges[e].c == c) return &edges[e].to;
+		}
+		return nullptr;
+	}
+	int step(int v, unsigned char c) const {
+		for (int e = st[v].edges; e >= 0; e = edges[e].next) {
+			if (edges[e].c == c) return edges[e].to;
+		}
+		return -1;
+	}
+	void addEdge(int v, unsigned char c, int to) {
+		edges.push_back({c, to, st[v].edges});
+		st[v].edges = (int)edges.size() - 1;
+	}
+
+public:
+	void build(const std::string &s, int lo, int hi) {
+		st.clear();
+		edges.clear();
+		base = lo;
+		st.push_back({0, -1, -1, -1});
+		int last = 0;
+		for (int i = lo; i < hi; ++i) {
+			unsigned char c = (unsigned char)s[i];
+			int cur = (int)st.size();
+			st.push_back({st[last].len + 1, 0, i - lo, -1});
+			int p = last;
+			while (p >= 0 && !target(p, c)) {
+				addEdge(p, c, cur);
+				p = st[p].link;
+			}
+			if (p >= 0) {
+				int q = *target(p, c);
+				if (st[p].len + 1 == st[q].len) {
+					st[cur].link = q;
+				} else {
+					int clone = (int)st.size();
+					st.push_back({st[p].len + 1, st[q].link, st[q].firstEnd, -1});
+					for (int e = st[q].edges; e >= 0; e = edges[e].next) addEdge(clone, edges[e].c, edges[e].to);
+					while (p >= 0) {
+						int *t = target(p, c);
+						if (!t || *t != q) break;
+						*t = clone;
+						p = st[p].link;
+					}
+					st[q].link = clone;
+					st[cur].link = clone;
+				}
+			}
+			last = cur;
+		}
+	}
+
+	// Longest block of s[lo, hi) that also occurs in the built range; returns its length and
+	// sets i/j to its start in s and in the built string
+	int longest(const std::string &s, int lo, int hi, int &i, int &j) const {
+		int v = 0, l = 0, best = 0;
+		i = lo;
+		j = base;
+		for (int p = lo; p < hi; ++p) {
+			unsigned char c = (unsigned char)s[p];
+			while (v > 0 && step(v, c) < 0) {
+				v = st[v].link;
+				l = st[v].len;
+			}
+			int t = step(v, c);
+			if (t >= 0) {
+				v = t;
+				++l;
+			} else {
+				v = 0;
+				l = 0;
+			}
+			if (l > best) {
+				best = l;
+				i = p - l + 1;
+				j = base + st[v].firstEnd - l + 1;
+			}
+		}
+		return best;
+	}
+};
+
+// Builds the highlight list the service forwards from spans and paragraph alignments, as the Python
+// post-processing did: a span on a single line pair is narrowed to the longest block the two lines
+// share (unless it was extended through edits, which the narrowing would undo), spans whose texts
+// are less than half similar are dropped, paragraphs that overlap an earlier highlight in B are
+// skipped, and overlapping highlights on the same lines are folded by a sort-and-sweep.
+class HighlightRefiner {
+public:
+	static const int minBlock = 6;
+	static constexpr double minRatio = 0.5;
+
+	void addArenaCounts(ArenaCounts &counts) const { counts.add(arena); }
+
+	void refine(const Document &a, const Document &b, const std::vector<MatchSpan> &spans,
+			const std::vector<Highlight> &paragraphs, bool exact, const CancelToken &cancel, std::vector<Highlight> &out) {
+		const std::vector<int> &linesA = a.rawLines;
+		const std::vector<int> &linesB = b.rawLines;
+		arena.reset();
+		std::pmr::unordered_map<uint64_t, Block> blockCache(&arena); // (lineA, lineB) -> longest shared block
+		for (const auto &sp : spans) {
+			if (cancel.expired()) return;
+			int sa = sp.rawStartA, ea = sp.rawEndA, sb = sp.rawStartB, eb = sp.rawEndB;
+			Highlight h;
+			lineMeta(a.raw, linesA, sa, ea, h.lineA, h.lineTextStartA, h.lineTextEndA);
+			lineMeta(b.raw, linesB, sb, eb, h.lineB, h.lineTextStartB, h.lineTextEndB);
+			h.lineStartA = a.lineOf(sa);
+			h.lineEndA = a.lineOf(std::max(ea - 1, sa));
+			h.lineStartB = b.lineOf(sb);
+			h.lineEndB = b.lineOf(std::max(eb - 1, sb));
+			bool singleLine = h.lineTextEndA > h.lineTextStartA && h.lineTextEndB > h.lineTextStartB
+				&& h.lineStartA == h.lineEndA && h.lineStartB == h.lineEndB;
+			h.edits = sp.edits;
+			if (singleLine && sp.edits == 0) {
+				const Block &best = lineBlock(a, b, h, blockCache);
+				if (best.len >= minBlock) {
+					sa = best.a0;
+					ea = best.a0 + best.len;
+					sb = best.b0;
+					eb = best.b0 + best.len;
+				}
+			}
+			// drop low-quality overlaps
+			if (eb - sb < minBlock) continue;
+			if (ratio(a.raw, sa, ea, b.raw, sb, eb, cancel) < minRatio) continue;
+			h.rawStartA = sa;
+			h.rawEndA = ea;
+			h.rawStartB = sb;
+			h.rawEndB = eb;
+			h.matchType = exact ? "exact" : "partial";
+			out.push_back(h);
+		}
+
+		// Paragraphs only fill in regions of B no span covers. Accepted paragraphs never overlap
+		// each other, so they are kept in an ordered map; spans are searched through a prefix
+		// maximum of their end offsets.
+		std::pmr::vector<std::pair<int, int>> spanB(&arena);
+		spanB.reserve(out.size());
+		for (const auto &h : out) spanB.push_back({h.rawStartB, h.rawEndB});
+		std::sort(spanB.begin(), spanB.end());
+		std::pmr::vector<int> maxEnd(spanB.size(), &arena);
+		for (size_t i = 0; i < spanB.size(); ++i) maxEnd[i] = std::max(spanB[i].second, i ? maxEnd[i - 1] : spanB[i].second);
+		std::pmr::map<int, int> taken(&arena);
+		for (const auto &p : paragraphs) {
+			int s = p.rawStartB, e = p.rawEndB;
+			size_t before = std::lower_bound(spanB.begin(), spanB.end(), std::make_pair(e, INT32_MIN)) - spanB.begin();
+			if (before > 0 && maxEnd[before - 1] > s) continue;
+			auto it = taken.lower_bound(e);
+			if (it != taken.begin() && std::prev(it)->second > s) continue;
+			taken.emplace(s, e);
+			Highlight h = p;
+			lineMeta(a.raw, linesA, h.rawStartA, h.rawEndA, h.lineA, h.lineTextStartA, h.lineTextEndA);
+			lineMeta(b.raw, linesB, h.rawStartB, h.rawEndB, h.lineB, h.lineTextStartB, h.lineTextEndB);
+			out.push_back(h);
+		}
+	}
+
+	// Keeps one highlight per run of overlapping highlights on the same lines (at least 60% of
+	// their B ranges and 40% of their A ranges shared), preferring paragraphs, then the longer one
+	static void dedup(std::vector<Highlight> &items) {
+		std::stable_sort(items.begin(), items.end(), [](const Highlight &x, const Highlight &y) {
+			return x.lineB != y.lineB ? x.lineB < y.lineB : x.rawStartB < y.rawStartB;
+		});
+		size_t kept = 0;
+		for (size_t i = 0; i < items.size(); ++i) {
+			const Highlight &h = items[i];
+			if (kept == 0) {
+				items[kept++] = h;
+				continue;
+			}
+			Highlight &last = items[kept - 1];
+			double rB = overlapRatio(h.rawStartB, h.rawEndB, last.rawStartB, last.rawEndB);
+			double rA = overlapRatio(h.rawStartA, h.rawEndA, last.rawStartA, last.rawEndA);
+			bool sameLines = h.lineA == last.lineA && h.lineB == last.lineB;
+			if (rB >= 0.6 && rA >= 0.4 && sameLines) {
+				int lenH = (h.rawEndB - h.rawStartB) + (h.rawEndA - h.rawStartA);
+				int lenLast = (last.rawEndB - last.rawStartB) + (last.rawEndA - last.rawStartA);
+				int prioH = priority(h), prioLast = priority(last);
+				if (prioH > prioLast || (prioH == prioLast && lenH > lenLast)) last = h;
+			} else {
+				items[kept++] = h;
+			}
+		}
+		items.resize(kept);
+	}
+
+private:
+	struct Block {
+		int a0, b0, len;
+	};
+	SuffixAutomaton sam;
+	BitParallelLcs lcs;
+	// Word operations allowed for the LCS bound of one span
+	static const long long maxLcsWork = 1 << 22;
+	Arena arena; // backs the per-call block cache and paragraph filter
+	std::vector<std::array<int, 4>> ranges;
+
+	static int priority(const Highlight &h) {
+		return std::strcmp(h.matchType, "paragraph") == 0 ? 2 : 1;
+	}
+
+	static double overlapRatio(int s1, int e1, int s2, int e2) {
+		int inter = std::max(0, std::min(e1, e2) - std::max(s1, s2));
+		int uni = std::max(e1, e2) - std::min(s1, s2);
+		return uni > 0 ? (double)inter / uni : 0.0;
+	}
+
+	// Line shown for a span: the line of its first character that is not a line break, and
+	// that line's raw range without its trailing \r / \n
+	static void lineMeta(const std::string &raw, const std::vector<int> &starts, int start, int end,
+			int &line, int &textStart, int &textEnd) {
+		int n = (int)raw.size();
+		if (start < 0) start = 0;
+		if (end <= start) end = std::min(n, start + 1);
+		int limit = std::min(n, std::max(end, start + 1));
+		int pos = std::max(0, std::min(start, n - 1));
+		while (pos < limit && (raw[pos] == '\r' || raw[pos] == '\n')) ++pos;
+		if (pos >= n) pos = n - 1;
+		line = rawLineOf(starts, pos);
+		textStart = starts[line - 1];
+		textEnd = (size_t)line < starts.size() ? starts[line] : n;
+		while (textEnd > textStart && (raw[textEnd - 1] == '\r' || raw[textEnd - 1] == '\n')) --textEnd;
+	}
+
+	// Longest block shared by the two lines of a highlight; spans on the same line pair reuse it
+	const Block &lineBlock(const Document &a, const Document &b, const Highlight &h, std::pmr::unordered_map<uint64_t, Block> &blockCache) {
+		uint64_t key = ((uint64_t)(uint32_t)h.lineA << 32) | (uint32_t)h.lineB;
+		auto it = blockCache.find(key);
+		if (it != blockCache.end()) return it->second;
+		Block blk;
+		sam.build(b.raw, h.lineTextStartB, h.lineTextEndB);
+		blk.len = sam.longest(a.raw, h.lineTextStartA, h.lineTextEndA, blk.a0, blk.b0);
+		return blockCache.emplace(key, blk).first->second;
+	}
+
+	// difflib's ratio(): 2 * M / T, where M is the size of the matching blocks found by taking
+	// the longest shared block and recursing on both sides of it
+	double ratio(const std::string &ra, int alo, int ahi, const std::string &rb, int blo, int bhi, const CancelToken &cancel) {
+		int la = std::max(0, ahi - alo), lb = std::max(0, bhi - blo);
+		int total = la + lb;
+		if (total == 0) return 1.0;
+		if (la == lb && ra.compare(alo, la, rb, blo, lb) == 0) return 1.0;
+		if (2.0 * std::min(la, lb) / total < minRatio) return 0.0;
+		// The blocks found below form a common subsequence, so the LCS ratio bounds the result.
+		// Where the bit-parallel pass is cheap, it rejects dissimilar spans without the recursion.
+		if ((long long)((std::min(la, lb) + 63) / 64) * std::max(la, lb) <= maxLcsWork) {
+			double bound = lcs.ratio(ra.data() + alo, la, rb.data() + blo, lb, cancel);
+			if (bound >= 0 && bound < minRatio) return bound;
+		}
+		long long matched = 0;
+		ranges.clear();
+		ranges.push_back({alo, alo + la, blo, blo + lb});
+		while (!ranges.empty() && !cancel.expired()) {
+			auto r = ranges.back();
+			ranges.pop_back();
+			sam.build(rb, r[2], r[3]);
+			int i, j;
+			int k = sam.longest(ra, r[0], r[1], i, j);
+			if (k == 0) continue;
+			matched += k;
+			if (r[0] < i && r[2] < j) ranges.push_back({r[0], i, r[2], j});
+			if (i + k < r[1] && j + k < r[3]) ranges.push_back({i + k, r[1], j + k, r[3]});
+		}
+		return 2.0 * matched / total;
+	}
+};
+
+static void writeHighlightJson(std::ostream &out, const Document &a, const Document &b, const Highlight &h, bool edits) {
+	out << "{\"rawStartA\":" << a.charOffset(h.rawStartA) << ",\"rawEndA\":" << a.charOffset(h.rawEndA)
+		<< ",\"rawStartB\":" << b.charOffset(h.rawStartB) << ",\"rawEndB\":" << b.charOffset(h.rawEndB)
+		<< ",\"lineStartA\":" << h.lineStartA << ",\"lineEndA\":" << h.lineEndA
+		<< ",\"lineStartB\":" << h.lineStartB << ",\"lineEndB\":" << h.lineEndB
+		<< ",\"lineA\":" << h.lineA << ",\"lineB\":" << h.lineB
+		<< ",\"columnA\":" << a.columnOf(h.rawStartA) << ",\"columnB\":" << b.columnOf(h.rawStartB)
+		<< ",\"sentenceA\":" << a.sentenceOf(h.rawStartA) << ",\"sentenceB\":" << b.sentenceOf(h.rawStartB)
+		<< ",\"textA\":\"";
+	writeJsonEscaped(out, a.raw.data() + h.rawStartA, std::max(0, h.rawEndA - h.rawStartA));
+	out << "\",\"textB\":\"";
+	writeJsonEscaped(out, b.raw.data() + h.rawStartB, std::max(0, h.rawEndB - h.rawStartB));
+	out << "\"";
+	if (h.lineTextStartA >= 0) {
+		out << ",\"lineTextA\":\"";
+		writeJsonEscaped(out, a.raw.data() + h.lineTextStartA, h.lineTextEndA - h.lineTextStartA);
+		out << "\",\"lineTextB\":\"";
+		writeJsonEscaped(out, b.raw.data() + h.lineTextStartB, h.lineTextEndB - h.lineTextStartB);
+		out << "\"";
+	}
+	if (edits) out << ",\"edits\":" << h.edits;
+	out << ",\"matchType\":\"" << h.matchType << "\"}";
+}
+
+// Per-phase wall time and work of one comparison, reported under "stats" with --stats
+struct PairStats {
+	long long preprocessNsA = 0, preprocessNsB = 0;  // one-off per document, shared by its pairs
+	long long rkNs = 0, jaccardNs = 0, finalizeNs = 0, sentencesNs = 0, paragraphsNs = 0, refineNs = 0, coverageNs = 0;
+	long long compareNs = 0;  // whole comparison, preprocessing and JSON excluded
+	RabinKarpStats rk;
+	long long shinglesA = 0, shinglesB = 0;
+	long long sentenceMatches = 0, paragraphRuns = 0, highlights = 0;
+	long long peakRssBytes = 0;  // process-wide high-water mark, 0 where unsupported
+};
+
+// Result of comparing one pair of documents
+struct PairResult {
+	double localScore = 0.0;
+	double rabinKarpScore = 0.0;
+	double jaccardScore = 0.0;
+	std::vector<MatchSpan> spans;
+	std::vector<Highlight> highlights;
+	double coverageA = 0.0;    // % of A's raw text covered by highlights
+	double coverageB = 0.0;    // % of B's raw text covered by highlights
+	double containment = 0.0;  // coverage of the shorter document
+	bool truncated = false;    // the time budget ran out before every stage finished
+	bool limited = false;      // occurrence or span caps were configured
+	bool editsCounted = false; // spans were extended through edits and carry their count
+	LimitStats limits;
+	bool hasStats = false;
+	PairStats stats;
+};
+
+// Percentage of [0, length) covered by the union of `ranges`. Ranges are painted into a bitmap
+// when there are many of them for the length; otherwise they are sorted and swept.
+static double coveragePercent(std::vector<std::pair<int, int>> &ranges, int length) {
+	if (length <= 0 || ranges.empty()) return 0.0;
+	long long covered = 0;
+	if ((long long)ranges.size() * 64 >= length) {
+		std::vector<uint64_t> bits(((size_t)length + 63) / 64, 0);
+		for (const auto &rg : ranges) {
+			int s = std::max(rg.first, 0), e = std::min(rg.second, length);
+			while (s < e && (s & 63)) bits[s >> 6] |= 1ULL << (s & 63), ++s;
+			while (s + 64 <= e) bits[s >> 6] = ~0ULL, s += 64;
+			while (s < e) bits[s >> 6] |= 1ULL << (s & 63), ++s;
+		}
+		for (uint64_t w : bits) covered += popcount64(w);
+	} else {
+		std::sort(ranges.begin(), ranges.end());
+		int runStart = ranges[0].first, runEnd = ranges[0].second;
+		for (size_t i = 1; i < ranges.size(); ++i) {
+			if (ranges[i].first <= runEnd) {
+				runEnd = std::max(runEnd, ranges[i].second);
+			} else {
+				covered += std::max(0, runEnd - runStart);
+				runStart = ranges[i].first;
+				runEnd = ranges[i].second;
+			}
+		}
+		covered += std::max(0, runEnd - runStart);
+	}
+	return (double)covered * 100.0 / (double)length;
+}
+
+static double combineScores(bool identical, double rkScore, double jcScore) {
+	// Always combine both algorithms for a more accurate score
+	double localScore;
+	// If files are identical, keep 100% score
+	if (identical) {
+		localScore = 100.0;
+	} 
+	// If files are completely different, keep 0% score
+	else if (rkScore == 0 && jcScore == 0) {
+		localScore = 0.0;
+	}
+	// For partial matches, combine both algorithms with higher weight to Jaccard
+	else {
+		// Jaccard is better at detecting partial similarity, so give it more weight
+		localScore = 0.4 * rkScore + 0.6 * jcScore;
+	}
+	return localScore;
+}
+
+// Per-worker checker instances; reused for every pair the worker handles so their internal
+// scratch buffers keep their capacity between comparisons.
+struct WorkerContext {
+	RabinKarpChecker rk;
+	TokenRabinKarpChecker tokenRk;  // used instead of rk for documents split into words
+	JaccardChecker jc;
+	SentenceMatcher sentences;
+	ParagraphAligner paragraphs;
+	HighlightRefiner refiner;
+	std::vector<Highlight> paragraphBuf;
+	CompareLimits limits;
+	CancelToken cancel;
+	bool collectStats = false;  // --stats: time phases and count work for every pair
+
+	// Bytes retained by the reusable buffers; with caps set this stays proportional to the
+	// largest documents seen plus the caps
+	size_t scratchBytes() const {
+		return rk.scratchBytes() + tokenRk.scratchBytes() + sentences.scratchBytes() + paragraphs.scratchBytes();
+	}
+
+	ArenaCounts arenaCounts() const {
+		ArenaCounts counts;
+		rk.addArenaCounts(counts);
+		sentences.addArenaCounts(counts);
+		paragraphs.addArenaCounts(counts);
+		refiner.addArenaCounts(counts);
+		return counts;
+	}
+};
+
+// Shingle sets may be passed in when the documents come from the DocumentCache
+[[maybe_unused]] static PairResult comparePair(const Document &a, const Document &b, WorkerContext &ctx,
+		const std::vector<uint64_t> *shinglesA = nullptr, const std::vector<uint64_t> *shinglesB = nullptr) {
+	PairResult r;
+	auto &rk = ctx.rk;
+	auto &jc = ctx.jc;
+	PairStats *st = ctx.collectStats ? &r.stats : nullptr;
+	r.hasStats = st != nullptr;
+	bool timed = st || tracer;
+	long long begin = timed ? monotonicNs() : 0, mark = begin;
+	// Charges the time since the previous phase ended to `phase` and traces it as `name`
+	auto lap = [&](const char *name, long long &phase) {
+		if (!timed) return;
+		long long now = monotonicNs();
+		if (tracer) tracer->record(name, mark, now);
+		phase = now - mark;
+		mark = now;
+	};
+	ctx.cancel.start(ctx.limits.timeoutMs);
+	bool words = a.tokenMode != TokenMode::chars;
+	if (words) {
+		ctx.tokenRk.setCancel(ctx.cancel);
+		ctx.tokenRk.setLimits(ctx.limits);
+		ctx.tokenRk.setStats(st ? &st->rk : nullptr);
+	} else {
+		rk.setCancel(ctx.cancel);
+		rk.setLimits(ctx.limits);
+		rk.setStats(st ? &st->rk : nullptr);
+	}
+	ctx.sentences.setLimits(ctx.limits);
+	ctx.paragraphs.setLimits(ctx.limits);
+	double rkScore = words ? ctx.tokenRk.score(a, b) : rk.score(a, b);
+	lap("rabinKarp", r.stats.rkNs);
+	double jcScore = shinglesA && shinglesB ? jc.score(a, b, *shinglesA, *shinglesB) : jc.score(a, b);
+	lap("jaccard", r.stats.jaccardNs);
+	r.localScore = combineScores(a.text == b.text, rkScore, jcScore);
+	r.rabinKarpScore = rkScore;
+	r.jaccardScore = jcScore;
+	r.spans = words ? ctx.tokenRk.matches() : rk.matches();
+	finalizeSpans(a, b, r.spans);
+	lap("finalizeSpans", r.stats.finalizeNs);
+	// Sentence matches, when there are any, replace the span and paragraph highlights
+	ctx.sentences.match(a, b, ctx.cancel, r.highlights);
+	lap("sentences", r.stats.sentencesNs);
+	bool aligned = r.highlights.empty();
+	if (st) st->sentenceMatches = (long long)r.highlights.size();
+	if (aligned) {
+		ctx.paragraphBuf.clear();
+		ctx.paragraphs.align(a, b, ctx.cancel, ctx.paragraphBuf);
+		lap("paragraphs", r.stats.paragraphsNs);
+		ctx.refiner.refine(a, b, r.spans, ctx.paragraphBuf, r.localScore == 100.0, ctx.cancel, r.highlights);
+		lap("refine", r.stats.refineNs);
+		if (st) st->paragraphRuns = (long long)ctx.paragraphBuf.size();
+	}
+	r.truncated = ctx.cancel.tripped();
+	r.limited = ctx.limits.maxOccurrences > 0 || ctx.limits.maxSpans > 0;
+	r.editsCounted = ctx.limits.maxEdits > 0 && !words;
+	if (r.limited) {
+		r.limits = words ? ctx.tokenRk.limitsHit() : rk.limitsHit();
+		r.limits.add(ctx.sentences.limitsHit());
+		if (aligned) r.limits.add(ctx.paragraphs.limitsHit());
+	}
+	HighlightRefiner::dedup(r.highlights);
+	// Coverage is measured in characters, as the service sees the texts
+	std::vector<std::pair<int, int>> rangesA, rangesB;
+	rangesA.reserve(r.highlights.size());
+	rangesB.reserve(r.highlights.size());
+	for (auto &h : r.highlights) {
+		h.rawStartA = a.charStart(h.rawStartA);
+		h.rawEndA = a.charEnd(h.rawEndA);
+		h.rawStartB = b.charStart(h.rawStartB);
+		h.rawEndB = b.charEnd(h.rawEndB);
+		rangesA.push_back({a.charOffset(h.rawStartA), a.charOffset(h.rawEndA)});
+		rangesB.push_back({b.charOffset(h.rawStartB), b.charOffset(h.rawEndB)});
+	}
+	int charsA = a.charOffset((int)a.raw.size()), charsB = b.charOffset((int)b.raw.size());
+	r.coverageA = coveragePercent(rangesA, charsA);
+	r.coverageB = coveragePercent(rangesB, charsB);
+	r.containment = charsA <= charsB ? r.coverageA : r.coverageB;
+	lap("coverage", r.stats.coverageNs);
+	if (st) {
+		st->compareNs = mark - begin;
+		st->rk.spans = (long long)r.spans.size();
+		st->shinglesA = (long long)(shinglesA ? shinglesA->size() : jc.shingleCountA());
+		st->shinglesB = (long long)(shinglesB ? shinglesB->size() : jc.shingleCountB());
+		st->highlights = (long long)r.highlights.size();
+		st->peakRssBytes = peakRssBytes();
+	}
+	return r;
+}
+
+// `extraFields` is spliced in front of the standard keys (e.g. "\"target\":\"x\",")
+[[maybe_unused]] static void writeResultJson(std::ostream &out, const Document &a, const Document &b, const PairResult &r,
+		const std::string &extraFields = std::string()) {
+	long long started = r.hasStats || tracer ? monotonicNs() : 0;
+    // Build JSON with matches from RK
+    out << "{" << extraFields << "\"localScore\":" << r.localScore << ",";
+    out << "\"rabinKarpScore\":" << r.rabinKarpScore << ",";
+    out << "\"jaccardScore\":" << r.jaccardScore << ",";
+	// Coverage is written at full precision so callers can reuse it as a score
+	auto precision = out.precision(17);
+	out << "\"coverageA\":" << r.coverageA << ",\"coverageB\":" << r.coverageB
+		<< ",\"containment\":" << r.containment << ",";
+	out.precision(precision);
+	out << "\"truncated\":" << (r.truncated ? "true" : "false") << ",";
+	if (r.limited) {
+		out << "\"limits\":{\"hit\":" << (r.limits.hit() ? "true" : "false") << ",\"skippedKeys\":" << r.limits.skippedKeys
+			<< ",\"droppedSpans\":" << r.limits.droppedSpans << "},";
+	}
+    out << "\"matches\":[";
+	const auto &spans = r.spans;
+	for (size_t i = 0; i < spans.size(); ++i) {
+		const auto &sp = spans[i];
+		out << "{\"startA\":" << sp.startA << ",\"endA\":" << sp.endA
+			<< ",\"startB\":" << sp.startB << ",\"endB\":" << sp.endB
+			<< ",\"textA\":\"";
+		writeJsonEscaped(out, sp.textA.data(), sp.textA.size());
+		out << "\",\"textB\":\"";
+		writeJsonEscaped(out, sp.textB.data(), sp.textB.size());
+		out << "\""
+			<< ",\"lineA\":" << sp.lineA << ",\"lineB\":" << sp.lineB
+			<< ",\"rawStartA\":" << a.charOffset(sp.rawStartA) << ",\"rawEndA\":" << a.charOffset(sp.rawEndA)
+			<< ",\"rawStartB\":" << b.charOffset(sp.rawStartB) << ",\"rawEndB\":" << b.charOffset(sp.rawEndB)
+			<< ",\"lineStartA\":" << a.lineOf(sp.rawStartA) << ",\"lineEndA\":" << a.lineOf(std::max(sp.rawEndA - 1, sp.rawStartA))
+			<< ",\"columnA\":" << a.columnOf(sp.rawStartA)
+			<< ",\"lineStartB\":" << b.lineOf(sp.rawStartB) << ",\"lineEndB\":" << b.lineOf(std::max(sp.rawEndB - 1, sp.rawStartB))
+			<< ",\"columnB\":" << b.columnOf(sp.rawStartB);
+		if (r.editsCounted) out << ",\"edits\":" << sp.edits;
+		out << "}";
+		if (i + 1 < spans.size()) out << ",";
+	}
+	out << "],\"highlights\":[";
+	for (size_t i = 0; i < r.highlights.size(); ++i) {
+		if (i) out << ",";
+		writeHighlightJson(out, a, b, r.highlights[i], r.editsCounted);
+	}
+	out << "]";
+	long long written = r.hasStats || tracer ? monotonicNs() : 0;
+	if (tracer) tracer->record("json", started, written);
+	if (r.hasStats) {
+		// JSON time covers everything written before the stats themselves
+		const PairStats &st = r.stats;
+		long long jsonNs = written - started;
+		out << ",\"stats\":{\"ns\":{\"preprocessA\":" << st.preprocessNsA << ",\"preprocessB\":" << st.preprocessNsB
+			<< ",\"rabinKarp\":" << st.rkNs << ",\"rkIndex\":" << st.rk.indexNs << ",\"rkProbe\":" << st.rk.probeNs
+			<< ",\"rkMerge\":" << st.rk.mergeNs << ",\"jaccard\":" << st.jaccardNs << ",\"finalizeSpans\":" << st.finalizeNs
+			<< ",\"sentences\":" << st.sentencesNs << ",\"paragraphs\":" << st.paragraphsNs << ",\"refine\":" << st.refineNs
+			<< ",\"coverage\":" << st.coverageNs << ",\"compare\":" << st.compareNs << ",\"json\":" << jsonNs << "}";
+		out << ",\"counts\":{\"windowsProbed\":" << st.rk.windowsProbed << ",\"windowHits\":" << st.rk.windowHits
+			<< ",\"verifyFailures\":" << st.rk.verifyFailures << ",\"occurrences\":" << st.rk.occurrences
+			<< ",\"diagonalSkips\":" << st.rk.diagonalSkips << ",\"extensions\":" << st.rk.extensions
+			<< ",\"candidates\":" << st.rk.candidates << ",\"spansMerged\":" << std::max(0LL, st.rk.candidates - st.rk.spans)
+			<< ",\"spans\":" << st.rk.spans << ",\"shinglesA\":" << st.shinglesA << ",\"shinglesB\":" << st.shinglesB
+			<< ",\"sentenceMatches\":" << st.sentenceMatches << ",\"paragraphRuns\":" << st.paragraphRuns
+			<< ",\"highlights\":" << st.highlights << "},\"peakRssBytes\":" << st.peakRssBytes << "}";
+	}
+	out << "}";
+}
+
+// Compact fingerprints of a document, built once and used to bound a pair's score before the
+// full checkers run. Windows and shingles are packed losslessly into integers, so shared
+// fingerprint counts give exactly the fraction of matching RK windows and the shingle overlap.
+struct DocumentFingerprint {
+	std::vector<uint64_t> shingles; // distinct Jaccard shingles
+	std::vector<uint64_t> probes;   // keys of the windows RabinKarpChecker probes when this is A
+	std::vector<uint64_t> windows;  // distinct keys of every window, for when this is B
+
+	// Shingles are always needed; window keys only for bounding scores in corpus mode
+	static DocumentFingerprint build(const Document &d, bool withWindows = true) {
+		DocumentFingerprint f;
+		JaccardChecker::shinglesOf(d, f.shingles);
+		if (withWindows) f.addWindows(d);
+		return f;
+	}
+
+	void addWindows(const Document &d) {
+		const std::string &t = d.text;
+		const int w = RabinKarpChecker::window;
+		probes.clear();
+		windows.clear();
+		if (d.tokenMode != TokenMode::chars) {
+			// Every n-gram is probed; hash collisions can only raise the bound
+			TokenRabinKarpChecker::gramHashes(d.tokens, TokenRabinKarpChecker::ngramFor(d.tokenMode), probes);
+			windows = probes;
+			std::sort(windows.begin(), windows.end());
+			windows.erase(std::unique(windows.begin(), windows.end()), windows.end());
+			return;
+		}
+		for (int i = 0; i + w <= (int)t.size(); ++i) {
+			uint64_t key = WindowIndex::keyAt(t, i, w);
+			windows.push_back(key);
+			if (i % RabinKarpChecker::step == 0) probes.push_back(key);
+		}
+		std::sort(windows.begin(), windows.end());
+		windows.erase(std::unique(windows.begin(), windows.end()), windows.end());
+	}
+
+	size_t bytes() const {
+		return (shingles.capacity() + probes.capacity() + windows.capacity()) * sizeof(uint64_t);
+	}
+};
+
+// Upper bound on comparePair(a, b).localScore from fingerprints alone, without span extension
+[[maybe_unused]] static double scoreUpperBound(const Document &a, const DocumentFingerprint &fa, const Document &b, const DocumentFingerprint &fb) {
+	if (a.text == b.text) return 100.0;
+
+	double rkBound = 100.0;
+	const int w = RabinKarpChecker::window;
+	const int n = TokenRabinKarpChecker::ngramFor(a.tokenMode);
+	bool probed = a.tokenMode == TokenMode::chars ? (int)a.text.size() >= w && (int)b.text.size() >= w
+		: (int)a.tokens.size() >= n && (int)b.tokens.size() >= n;
+	if (probed) {
+		int matched = 0;
+		for (uint64_t key : fa.probes) {
+			if (std::binary_search(fb.windows.begin(), fb.windows.end(), key)) matched++;
+		}
+		rkBound = fa.probes.empty() ? 0.0 : (double)matched * 100.0 / (double)fa.probes.size();
+	}
+	double jcBound = JaccardChecker::similarity(fa.shingles, fb.shingles);
+	return combineScores(false, rkBound, jcBound);
+}
+
+// Fixed-size pool of workers, each owning a task deque. A worker drains its own deque from the
+// front and, when empty, steals from the back of another worker's deque, so a few very large
+// comparisons do not leave the remaining workers idle.
+class WorkStealingPool {
+private:
+	struct WorkerQueue {
+		std::mutex m;
+		std::deque<int> tasks;
+	};
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex m;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(int, int)> *job = nullptr;
+	std::atomic<int> pending{0};
+	int active = 0;
+	long long generation = 0;
+	bool stopping = false;
+
+	bool popLocal(int worker, int &task) {
+		auto &q = *queues[worker];
+		std::lock_guard<std::mutex> lock(q.m);
+		if (q.tasks.empty()) return false;
+		task = q.tasks.front();
+		q.tasks.pop_front();
+		return true;
+	}
+
+	bool steal(int thief, int &task) {
+		int n = (int)queues.size();
+		for (int k = 1; k < n; ++k) {
+			auto &q = *queues[(thief + k) % n];
+			std::lock_guard<std::mutex> lock(q.m);
+			if (q.tasks.empty()) continue;
+			task = q.tasks.back();
+			q.tasks.pop_back();
+			return true;
+		}
+		return false;
+	}
+
+	void workerLoop(int worker) {
+		if (tracer) tracer->nameThread("worker " + std::to_string(worker));
+		long long seen = 0;
+		for (;;) {
+			const std::function<void(int, int)> *fn;
+			{
+				std::unique_lock<std::mutex> lock(m);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping) return;
+				seen = generation;
+				fn = job;
+				if (!fn) continue;
+				active++;
+			}
+			int task;
+			while (popLocal(worker, task) || steal(worker, task)) {
+				(*fn)(task, worker);
+				pending.fetch_sub(1);
+			}
+			// Only report back once this worker can no longer touch the current job
+			std::lock_guard<std::mutex> lock(m);
+			if (--active == 0) done.notify_all();
+		}
+	}
+
+public:
+	explicit WorkStealingPool(int threadCount) {
+		if (threadCount < 1) threadCount = 1;
+		for (int i = 0; i < threadCount; ++i) queues.emplace_back(new WorkerQueue());
+		for (int i = 0; i < threadCount; ++i) threads.emplace_back([this, i] { workerLoop(i); });
+	}
+
+	~WorkStealingPool() {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto &t : threads) t.join();
+	}
+
+	int size() const { return (int)threads.size(); }
+
+	// Runs fn(task, worker) for every task in order and blocks until all have finished.
+	// Tasks are dealt round-robin, so passing them largest-first approximates LPT scheduling.
+	void run(const std::vector<int> &order, const std::function<void(int, int)> &fn) {
+		if (order.empty()) return;
+		for (size_t i = 0; i < order.size(); ++i) {
+			auto &q = *queues[i % queues.size()];
+			std::lock_guard<std::mutex> lock(q.m);
+			q.tasks.push_back(order[i]);
+		}
+		std::unique_lock<std::mutex> lock(m);
+		pending = (int)order.size();
+		job = &fn;
+		generation++;
+		wake.notify_all();
+		done.wait(lock, [&] { return pending.load() == 0 && active == 0; });
+		job = nullptr;
+	}
+};
+
+// 128-bit content digest
+struct Hash128 {
+	uint64_t lo = 0;
+	uint64_t hi = 0;
+	bool operator==(const Hash128 &o) const { return lo == o.lo && hi == o.hi; }
+	std::string hex() const {
+		static const char digits[] = "0123456789abcdef";
+		std::string out(32, '0');
+		for (int i = 0; i < 16; ++i) {
+			out[15 - i] = digits[(hi >> (4 * i)) & 0xf];
+			out[31 - i] = digits[(lo >> (4 * i)) & 0xf];
+		}
+		return out;
+	}
+};
+
+struct Hash128Hasher {
+	size_t operator()(const Hash128 &h) const { return (size_t)(h.lo ^ (h.hi * 0x9e3779b97f4a7c15ULL)); }
+};
+
+// MurmurHash3 x64/128: processes 16 bytes per round, well above the cost of reading the file
+static Hash128 hash128(const void *data, size_t len, uint64_t seed = 0) {
+	auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+	auto fmix = [](uint64_t k) {
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return k;
+	};
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+	uint64_t h1 = seed, h2 = seed;
+	size_t blocks = len / 16;
+	for (size_t i = 0; i < blocks; ++i) {
+		uint64_t k1, k2;
+		std::memcpy(&k1, p + 16 * i, 8);
+		std::memcpy(&k2, p + 16 * i + 8, 8);
+		k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+	const unsigned char *tail = p + 16 * blocks;
+	uint64_t k1 = 0, k2 = 0;
+	size_t rest = len & 15;
+	for (size_t i = rest; i > 8; --i) k2 = (k2 << 8) | tail[i - 1];
+	for (size_t i = std::min<size_t>(rest, 8); i > 0; --i) k1 = (k1 << 8) | tail[i - 1];
+	if (rest > 8) { k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2; }
+	if (rest > 0) { k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1; }
+	h1 ^= len; h2 ^= len;
+	h1 += h2; h2 += h1;
+	h1 = fmix(h1); h2 = fmix(h2);
+	h1 += h2; h2 += h1;
+	return {h1, h2};
+}
+
+// Identifies checker settings in cache keys; bump when scoring or output changes
+static const char *checkerParams() {
+	static const std::string params = "rk:w" + std::to_string(RabinKarpChecker::window) + "s" + std::to_string(RabinKarpChecker::step)
+		+ ";jc:k" + std::to_string(JaccardChecker::k) + ";out:v10";
+	return params.c_str();
+}
+
+// Finished result JSON keyed by the digests of both raw texts plus checker parameters; results
+// carry raw slices and offsets, so texts that only preprocess alike must not share an entry.
+// The in-memory tier is an LRU list bounded by bytes; with a directory configured, entries are
+// also written through to disk so they survive across processes. The directory is private to
+// the owner and bounded too: past its byte budget the least recently used files are removed.
+class ResultCache {
+private:
+	struct Entry {
+		Hash128 key;
+		std::string value;
+	};
+	// Approximate per-entry bookkeeping on top of the stored JSON
+	static const size_t entryOverhead = 96;
+	std::list<Entry> lru;
+	std::unordered_map<Hash128, std::list<Entry>::iterator, Hash128Hasher> index;
+	size_t bytes = 0;
+	size_t capacity;
+	std::string dir;
+	size_t diskCapacity;
+	size_t diskBytes = 0;
+	std::mutex m;
+	std::mutex diskMutex;
+
+	std::string pathFor(const Hash128 &key) const { return dir + "/" + key.hex() + ".json"; }
+
+	void insertLocked(const Hash128 &key, const std::string &value) {
+		auto it = index.find(key);
+		if (it != index.end()) {
+			bytes -= it->second->value.size() + entryOverhead;
+			lru.erase(it->second);
+			index.erase(it);
+		}
+		size_t cost = value.size() + entryOverhead;
+		if (cost > capacity) return;
+		lru.push_front({key, value});
+		index[key] = lru.begin();
+		bytes += cost;
+		while (bytes > capacity) {
+			auto &victim = lru.back();
+			bytes -= victim.value.size() + entryOverhead;
+			index.erase(victim.key);
+			lru.pop_back();
+		}
+	}
+
+	// Creates the directory readable by the owner only. A directory that already exists and
+	// belongs to someone else, or is a symlink, is not used: its entries could be planted.
+	static bool openPrivateDirectory(const std::string &path) {
+		std::error_code ec;
+		std::filesystem::create_directories(path, ec);
+		if (ec) return false;
+#ifndef _WIN32
+		struct stat info;
+		if (lstat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid()) return false;
+#endif
+		std::filesystem::permissions(path, std::filesystem::perms::owner_all, std::filesystem::perm_options::replace, ec);
+		return !ec;
+	}
+
+	// Rescans the directory, which other processes may share, and removes the least recently
+	// used entries until it is back under three quarters of the budget, so the scan is amortised
+	// over many writes. Called with diskMutex held.
+	void pruneDiskLocked() {
+		struct File {
+			std::filesystem::file_time_type used;
+			size_t size;
+			std::filesystem::path path;
+		};
+		std::vector<File> files;
+		size_t total = 0;
+		std::error_code ec;
+		for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+			if (it->path().extension() != ".json") continue;
+			std::error_code fileError;
+			size_t size = (size_t)it->file_size(fileError);
+			auto used = it->last_write_time(fileError);
+			if (fileError) continue;
+			files.push_back({used, size, it->path()});
+			total += size;
+		}
+		diskBytes = total;
+		if (total <= diskCapacity) return;
+		std::sort(files.begin(), files.end(), [](const File &x, const File &y) { return x.used < y.used; });
+		size_t target = diskCapacity / 4 * 3;
+		for (const File &file : files) {
+			if (diskBytes <= target) break;
+			std::error_code removeError;
+			if (std::filesystem::remove(file.path, removeError)) diskBytes -= file.size;
+		}
+	}
+
+public:
+	// Atomic so a metrics scrape can read them while requests are served
+	std::atomic<long long> hits{0};
+	std::atomic<long long> diskHits{0};
+	std::atomic<long long> misses{0};
+
+	explicit ResultCache(size_t capacityBytes, std::string directory = std::string(), size_t diskCapacityBytes = (size_t)256 << 20)
+		: capacity(capacityBytes), dir(std::move(directory)), diskCapacity(diskCapacityBytes) {
+		if (!dir.empty() && !openPrivateDirectory(dir)) {
+			std::cerr << "cpp_checker: not caching results in " << dir << " (cannot create it, or it is not a private directory)" << std::endl;
+			dir.clear();
+		}
+		if (!dir.empty()) {
+			std::lock_guard<std::mutex> lock(diskMutex);
+			pruneDiskLocked();
+		}
+	}
+
+	static Hash128 keyFor(const Hash128 &digestA, const Hash128 &digestB, TokenMode mode, CodeLanguage languageA, CodeLanguage languageB,
+			const CompareLimits &limits) {
+		// Occurrence and span caps change the result; the time budget only decides whether it is cached
+		int caps[2] = {limits.maxOccurrences, limits.maxSpans};
+		std::string params = checkerParams();
+		if (limits.maxEdits > 0) params += ";edits:" + std::to_string(limits.maxEdits);
+		if (mode != TokenMode::chars) {
+			params += std::string(";mode:") + tokenModeName(mode) + "n" + std::to_string(TokenRabinKarpChecker::ngramFor(mode))
+				+ "k" + std::to_string(JaccardChecker::tokenShingleSize(mode));
+		}
+		if (mode == TokenMode::code) params += std::string(";lang:") + codeLanguageName(languageA) + "," + codeLanguageName(languageB);
+		Hash128 parts[4] = {
+			digestA,
+			digestB,
+			hash128(params.data(), params.size()),
+			hash128(caps, sizeof(caps)),
+		};
+		return hash128(parts, sizeof(parts));
+	}
+
+	bool get(const Hash128 &key, std::string &out) {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			auto it = index.find(key);
+			if (it != index.end()) {
+				lru.splice(lru.begin(), lru, it->second);
+				out = it->second->value;
+				hits++;
+				return true;
+			}
+		}
+		if (!dir.empty()) {
+			std::ifstream in(pathFor(key), std::ios::binary);
+			if (in) {
+				std::ostringstream ss;
+				ss << in.rdbuf();
+				out = ss.str();
+				in.close();
+				// Mark the entry recently used for disk eviction
+				std::error_code ec;
+				std::filesystem::last_write_time(pathFor(key), std::filesystem::file_time_type::clock::now(), ec);
+				std::lock_guard<std::mutex> lock(m);
+				insertLocked(key, out);
+				diskHits++;
+				return true;
+			}
+		}
+		std::lock_guard<std::mutex> lock(m);
+		misses++;
+		return false;
+	}
+
+	void put(const Hash128 &key, const std::string &value) {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			insertLocked(key, value);
+		}
+		if (!dir.empty()) {
+			// Write then rename so a concurrent reader never sees a partial entry
+			std::string path = pathFor(key);
+			std::string tmp = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+			{
+				std::ofstream outFile(tmp, std::ios::binary | std::ios::trunc);
+				outFile << value;
+				if (!outFile) return;
+			}
+			std::error_code ec;
+			std::filesystem::rename(tmp, path, ec);
+			if (ec) {
+				std::filesystem::remove(tmp, ec);
+				return;
+			}
+			std::lock_guard<std::mutex> lock(diskMutex);
+			diskBytes += value.size();
+			if (diskBytes > diskCapacity) pruneDiskLocked();
+		}
+	}
+
+	// In-memory entries and their bytes
+	std::pair<size_t, size_t> usage() {
+		std::lock_guard<std::mutex> lock(m);
+		return {index.size(), bytes};
+	}
+};
+
+// A preprocessed document together with its fingerprints, shared read-only between requests
+struct CachedDocument {
+	Hash128 digest;
+	Document doc;
+	long long preprocessNs = 0;  // preprocessing and fingerprinting time, reported by --stats
+
+	// The default argument reads the clock before any member is built. In the token modes the
+	// document is also tokenized (word mode interns into `vocabulary`, code mode lexes with the
+	// comment syntax of `language`), and its shingles are built from the tokens.
+	CachedDocument(const Hash128 &contentDigest, std::string raw, TokenMode mode = TokenMode::chars, Vocabulary *vocabulary = nullptr,
+			CodeLanguage language = CodeLanguage::cFamily, long long startedNs = monotonicNs())
+		: digest(contentDigest), doc(std::move(raw)) {
+		if (mode == TokenMode::words) doc.tokenizeWords(*vocabulary);
+		else if (mode == TokenMode::code) doc.tokenizeCode(language);
+		print = DocumentFingerprint::build(doc, false);
+		preprocessNs = monotonicNs() - startedNs;
+	}
+
+	const std::vector<uint64_t> &shingles() const { return print.shingles; }
+
+	// Window keys are only needed to bound scores in corpus mode, so they are built on first use
+	const DocumentFingerprint &fingerprint() const {
+		std::call_once(windowsOnce, [this] { print.addWindows(doc); });
+		return print;
+	}
+
+	size_t bytes() const { return doc.bytes() + print.bytes(); }
+
+private:
+	mutable DocumentFingerprint print;
+	mutable std::once_flag windowsOnce;
+};
+
+// Preprocessed documents keyed by a digest of their raw content, so a reference text compared
+// against many submissions is preprocessed and fingerprinted once. Entries are evicted least
+// recently used first once their total size passes the byte budget; documents still held by a
+// running comparison stay alive through their shared_ptr. Threads asking for a document that is
+// still being preprocessed wait for that result instead of preprocessing it again.
+class DocumentCache {
+private:
+	typedef std::shared_ptr<const CachedDocument> DocumentPtr;
+	struct Entry {
+		Hash128 key;
+		DocumentPtr doc;
+		size_t bytes;
+	};
+	std::list<Entry> lru;
+	std::unordered_map<Hash128, std::list<Entry>::iterator, Hash128Hasher> index;
+	std::unordered_map<Hash128, std::shared_future<DocumentPtr>, Hash128Hasher> inFlight;
+	size_t bytes = 0;
+	size_t capacity;
+	TokenMode mode = TokenMode::chars;
+	Vocabulary *vocabulary = nullptr;
+	bool languageFixed = false;
+	CodeLanguage language = CodeLanguage::cFamily;
+	std::mutex m;
+
+public:
+	std::atomic<long long> hits{0};
+	std::atomic<long long> misses{0};
+	std::atomic<long long> evictions{0};
+
+	explicit DocumentCache(size_t capacityBytes) : capacity(capacityBytes) {}
+
+	// Tokenizes every document loaded from now on; the word mode interns into `words`. Documents
+	// are keyed by content only, so this is set once, before the first load.
+	void setTokenMode(TokenMode tokenMode, Vocabulary *words) {
+		mode = tokenMode;
+		vocabulary = words;
+	}
+
+	// Lexes every code-mode document with `codeLanguage` instead of picking it by file extension
+	void setCodeLanguage(CodeLanguage codeLanguage) {
+		languageFixed = true;
+		language = codeLanguage;
+	}
+
+	// `codeLanguage` only matters in the code mode, where the same text lexes differently per
+	// language, so it is part of the entry's key there
+	DocumentPtr get(std::string raw, CodeLanguage codeLanguage = CodeLanguage::cFamily) {
+		Hash128 digest = hash128(raw.data(), raw.size());
+		Hash128 key = digest;
+		if (mode == TokenMode::code) key.lo ^= (uint64_t)codeLanguage * 0x9e3779b97f4a7c15ULL;
+		std::promise<DocumentPtr> ready;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			auto it = index.find(key);
+			if (it != index.end()) {
+				lru.splice(lru.begin(), lru, it->second);
+				hits++;
+				return it->second->doc;
+			}
+			auto pending = inFlight.find(key);
+			if (pending != inFlight.end()) {
+				std::shared_future<DocumentPtr> shared = pending->second;
+				lock.unlock();
+				hits++;
+				return shared.get();
+			}
+			inFlight.emplace(key, ready.get_future().share());
+		}
+		misses++;
+		// Preprocess outside the lock; concurrent requests for the same text wait on the promise
+		DocumentPtr doc;
+		try {
+			TraceScope span("preprocess", "bytes", (long long)raw.size());
+			doc = std::make_shared<const CachedDocument>(digest, std::move(raw), mode, vocabulary, codeLanguage);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(m);
+			inFlight.erase(key);
+			ready.set_exception(std::current_exception());
+			throw;
+		}
+		size_t cost = doc->bytes();
+		{
+			std::lock_guard<std::mutex> lock(m);
+			inFlight.erase(key);
+			if (cost <= capacity) {
+				lru.push_front({key, doc, cost});
+				index[key] = lru.begin();
+				bytes += cost;
+				while (bytes > capacity) {
+					auto &victim = lru.back();
+					bytes -= victim.bytes;
+					index.erase(victim.key);
+					lru.pop_back();
+					evictions++;
+				}
+			}
+		}
+		ready.set_value(doc);
+		return doc;
+	}
+
+	// Null if the file cannot be read, so that it is never mistaken for an empty document
+	DocumentPtr load(const std::string &path) {
+		std::string raw;
+		if (!Document::readFile(path, raw)) return nullptr;
+		return get(std::move(raw), languageFixed ? language : CodeLexer::languageOf(path));
+	}
+
+	double hitRate() const {
+		long long total = hits + misses;
+		return total == 0 ? 0.0 : (double)hits * 100.0 / (double)total;
+	}
+
+	// Entries and their bytes
+	std::pair<size_t, size_t> usage() {
+		std::lock_guard<std::mutex> lock(m);
+		return {index.size(), bytes};
+	}
+
+	void writeStatsJson(std::ostream &out) {
+		std::lock_guard<std::mutex> lock(m);
+		out << "{\"entries\":" << index.size() << ",\"bytes\":" << bytes << ",\"capacityBytes\":" << capacity
+			<< ",\"hits\":" << hits << ",\"misses\":" << misses << ",\"evictions\":" << evictions
+			<< ",\"hitRate\":" << hitRate() << "}";
+	}
+};
+
+// bench.cpp and tests.cpp include this file with CPP_CHECKER_NO_MAIN to reuse the checkers; the
+// command-line drivers from here on are left out of those builds
+#ifndef CPP_CHECKER_NO_MAIN
+static int defaultThreadCount() {
+	unsigned n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : (int)n;
+}
+
+// How checkPairJson produced its answer, for the serve-mode metrics
+struct PairOutcome {
+	bool cached = false;
+	bool truncated = false;
+	bool limitsHit = false;
+};
+
+// Result JSON for one pair, served from the cache when the same texts were checked before.
+// Profiled runs (--stats) always compare, and their results are not cached.
+static std::string checkPairJson(const CachedDocument &da, const CachedDocument &db, WorkerContext &ctx, ResultCache *cache,
+		PairOutcome *outcome = nullptr) {
+	const Document &a = da.doc;
+	const Document &b = db.doc;
+	Hash128 key;
+	std::string json;
+	if (ctx.collectStats) cache = nullptr;
+	if (cache) {
+		key = ResultCache::keyFor(da.digest, db.digest, a.tokenMode, a.codeLanguage, b.codeLanguage, ctx.limits);
+		if (cache->get(key, json)) {
+			if (outcome) outcome->cached = true;
+			return json;
+		}
+	}
+	std::ostringstream out;
+	PairResult r = comparePair(a, b, ctx, &da.shingles(), &db.shingles());
+	r.stats.preprocessNsA = da.preprocessNs;
+	r.stats.preprocessNsB = db.preprocessNs;
+	writeResultJson(out, a, b, r);
+	json = out.str();
+	// A truncated result depends on the time budget, not just the texts
+	if (cache && !r.truncated) cache->put(key, json);
+	if (outcome) {
+		outcome->truncated = r.truncated;
+		outcome->limitsHit = r.limits.hit();
+	}
+	return json;
+}
+
+// Answer for a pair whose file could not be read, in place of its result JSON
+static std::string unreadableJson(const std::string &path) {
+	return "{\"error\":\"cannot read " + jsonEscape(path) + "\"}";
+}
+
+// Result JSON for one pair, or the error of its first unreadable file
+static std::string pairJson(const std::string &pathA, const CachedDocument *da, const std::string &pathB, const CachedDocument *db,
+		WorkerContext &ctx, ResultCache *cache, PairOutcome *outcome = nullptr) {
+	if (!da) return unreadableJson(pathA);
+	if (!db) return unreadableJson(pathB);
+	return checkPairJson(*da, *db, ctx, cache, outcome);
+}
+
+// Newline-delimited JSON output shared by the workers of a streaming run. Every record is one
+// object on its own line, numbered by a sequence id in write order and flushed immediately.
+class NdjsonWriter {
+private:
+	std::ostream &out;
+	std::mutex m;
+	long long seq = 0;
+
+public:
+	explicit NdjsonWriter(std::ostream &stream) : out(stream) {}
+
+	// fields is the body of a JSON object without its braces
+	void write(const std::string &fields) {
+		std::lock_guard<std::mutex> lock(m);
+		out << "{\"seq\":" << seq++ << "," << fields << "}\n";
+		out.flush();
+	}
+};
+
+// Compares pairs (files[2p], files[2p+1]) on a work-stealing pool, largest first. Each distinct
+// path is loaded and preprocessed once up front and shared by every pair that names it. Results
+// are written in pair order as soon as a pair and all pairs before it have finished; labelled
+// results also carry their pair index and file names. When streaming, each labelled result is
+// written as its own NDJSON record the moment it completes, followed by a closing "done" record.
+static int runBatch(const std::vector<std::string> &files, bool labelled, bool stream, int threads, const CompareLimits &limits,
+		bool stats, DocumentCache &docs, ResultCache *cache) {
+	int pairCount = (int)files.size() / 2;
+	std::vector<std::string> paths;
+	std::unordered_map<std::string, int> pathIndex;
+	std::vector<int> docOf(files.size());
+	for (size_t f = 0; f < files.size(); ++f) {
+		auto it = pathIndex.emplace(files[f], (int)paths.size()).first;
+		if (it->second == (int)paths.size()) paths.push_back(files[f]);
+		docOf[f] = it->second;
+	}
+
+	WorkStealingPool pool(std::min(threads, (int)paths.size()));
+	std::vector<WorkerContext> contexts(pool.size());
+	for (auto &ctx : contexts) {
+		ctx.limits = limits;
+		ctx.collectStats = stats;
+	}
+	long long missesBefore = docs.misses;
+	std::vector<std::shared_ptr<const CachedDocument>> loaded(paths.size());
+	std::vector<int> order(paths.size());
+	for (size_t d = 0; d < paths.size(); ++d) order[d] = (int)d;
+	pool.run(order, [&](int d, int) { loaded[d] = docs.load(paths[d]); });
+	long long preprocessed = docs.misses - missesBefore;
+
+	auto rawSize = [&](int f) { return loaded[docOf[f]] ? (double)loaded[docOf[f]]->doc.raw.size() : 0.0; };
+	std::vector<double> cost(pairCount);
+	for (int p = 0; p < pairCount; ++p) {
+		double sa = rawSize(2 * p);
+		double sb = rawSize(2 * p + 1);
+		// Indexing B and probing A are both linear, but each hit extends along both texts
+		cost[p] = sa + sb + std::min(sa, sb);
+	}
+	order.resize(pairCount);
+	for (int p = 0; p < pairCount; ++p) order[p] = p;
+	std::stable_sort(order.begin(), order.end(), [&](int x, int y) { return cost[x] > cost[y]; });
+
+	std::string documents = "\"documents\":{\"distinct\":" + std::to_string(paths.size())
+		+ ",\"preprocessed\":" + std::to_string(preprocessed) + "}";
+	if (stream) {
+		NdjsonWriter writer(std::cout);
+		pool.run(order, [&](int p, int worker) {
+			TraceScope span("pair", "pair", p);
+			std::string json = pairJson(files[2 * p], loaded[docOf[2 * p]].get(), files[2 * p + 1], loaded[docOf[2 * p + 1]].get(),
+				contexts[worker], cache);
+			writer.write("\"pair\":" + std::to_string(p) + ",\"fileA\":\"" + jsonEscape(files[2 * p]) + "\",\"fileB\":\""
+				+ jsonEscape(files[2 * p + 1]) + "\"," + json.substr(1, json.size() - 2));
+		});
+		writer.write("\"done\":true,\"pairs\":" + std::to_string(pairCount) + "," + documents);
+		return 0;
+	}
+
+	std::vector<std::string> results(pairCount);
+	std::vector<bool> finished(pairCount, false);
+	std::mutex outputLock;
+	int written = 0;
+	std::cout << "{\"results\":[" << std::flush;
+	pool.run(order, [&](int p, int worker) {
+		TraceScope span("pair", "pair", p);
+		std::string json = pairJson(files[2 * p], loaded[docOf[2 * p]].get(), files[2 * p + 1], loaded[docOf[2 * p + 1]].get(),
+			contexts[worker], cache);
+		if (labelled) {
+			json = "{\"pair\":" + std::to_string(p) + ",\"fileA\":\"" + jsonEscape(files[2 * p]) + "\",\"fileB\":\""
+				+ jsonEscape(files[2 * p + 1]) + "\"," + json.substr(1);
+		}
+		std::lock_guard<std::mutex> lock(outputLock);
+		results[p] = std::move(json);
+		finished[p] = true;
+		bool progressed = false;
+		while (written < pairCount && finished[written]) {
+			if (written) std::cout << ",";
+			std::cout << results[written];
+			std::string().swap(results[written]);
+			written++;
+			progressed = true;
+		}
+		if (progressed) std::cout.flush();
+	});
+	std::cout << "]," << documents << "}" << std::endl;
+	return 0;
+}
+
+// Reads a batch manifest into (fileA, fileB) pairs. Each non-empty line is either
+// "<fileA>\t<fileB>" for one pair, "<query>" alone to start a query group, or "\t<target>" to
+// compare the current query with target. Lines starting with '#' are comments.
+static bool readManifest(std::istream &in, std::vector<std::string> &files, std::string &error) {
+	std::string line;
+	std::string query;
+	int lineNumber = 0;
+	while (std::getline(in, line)) {
+		lineNumber++;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+		size_t tab = line.find('\t');
+		if (tab == std::string::npos) {
+			query = line;
+			continue;
+		}
+		std::string first = line.substr(0, tab);
+		std::string second = line.substr(tab + 1);
+		if (first.empty()) first = query;
+		if (first.empty() || second.empty()) {
+			error = "line " + std::to_string(lineNumber) + ": expected <fileA>\\t<fileB>, <query> or \\t<target>";
+			return false;
+		}
+		files.push_back(first);
+		files.push_back(second);
+	}
+	return true;
+}
+
+// Compares files[0] against every other file. With topK > 0 only the k best targets are reported:
+// candidates are visited in order of a fingerprint upper bound, and once k results are held,
+// any candidate whose bound cannot beat the weakest of them is skipped without span extension.
+// When streaming, every full comparison is written as an NDJSON record as soon as it finishes and
+// a closing "done" record lists the reported targets in rank order. Targets that cannot be read
+// are reported as errors and never ranked; an unreadable query fails the whole run.
+static int runCorpus(const std::vector<std::string> &files, int threads, int topK, bool stream, const CompareLimits &limits,
+		bool stats, DocumentCache &docs) {
+	int targetCount = (int)files.size() - 1;
+	WorkStealingPool pool(std::min(threads, std::max(targetCount, 1)));
+	std::vector<WorkerContext> contexts(pool.size());
+	for (auto &ctx : contexts) {
+		ctx.limits = limits;
+		ctx.collectStats = stats;
+	}
+
+	auto query = docs.load(files[0]);
+	if (!query) {
+		std::cout << unreadableJson(files[0]) << std::endl;
+		return 1;
+	}
+	std::vector<std::shared_ptr<const CachedDocument>> targets(targetCount);
+	std::vector<double> bound(targetCount, 100.0);
+	std::vector<int> order(targetCount);
+	for (int t = 0; t < targetCount; ++t) order[t] = t;
+	pool.run(order, [&](int t, int) {
+		targets[t] = docs.load(files[t + 1]);
+		if (topK > 0 && targets[t]) bound[t] = scoreUpperBound(query->doc, query->fingerprint(), targets[t]->doc, targets[t]->fingerprint());
+	});
+	std::vector<int> unreadable;
+	for (int t = 0; t < targetCount; ++t) if (!targets[t]) unreadable.push_back(t);
+	order.erase(std::remove_if(order.begin(), order.end(), [&](int t) { return !targets[t]; }), order.end());
+	std::stable_sort(order.begin(), order.end(), [&](int x, int y) { return bound[x] > bound[y]; });
+	auto unreadableFields = [&](int t) {
+		std::string json = unreadableJson(files[t + 1]);
+		return "\"target\":\"" + jsonEscape(files[t + 1]) + "\",\"index\":" + std::to_string(t) + "," + json.substr(1, json.size() - 2);
+	};
+
+	// Min-heap on (score, -index) holding the best results seen so far
+	std::vector<PairResult> results(targetCount);
+	std::vector<bool> scored(targetCount, false);
+	auto weaker = [&](int x, int y) {
+		if (results[x].localScore != results[y].localScore) return results[x].localScore > results[y].localScore;
+		return x < y;
+	};
+	std::vector<int> heap;
+	std::unique_ptr<NdjsonWriter> writer;
+	if (stream) writer.reset(new NdjsonWriter(std::cout));
+	if (writer) for (int t : unreadable) writer->write(unreadableFields(t));
+	// Targets go to the pool in bound order in one run, so idle workers keep stealing until the end. In
+	// top-k mode each task re-checks its bound against the current weakest kept result just before the
+	// full comparison; a bound is never below its score, so a skipped target could not have been kept.
+	std::mutex heapMutex;
+	int fullComparisons = 0;
+	pool.run(order, [&](int t, int worker) {
+		if (topK > 0) {
+			std::lock_guard<std::mutex> lock(heapMutex);
+			if ((int)heap.size() == topK && bound[t] < results[heap.front()].localScore) return;
+		}
+		TraceScope span("pair", "target", t);
+		auto &ctx = contexts[worker];
+		PairResult result = comparePair(query->doc, targets[t]->doc, ctx, &query->shingles(), &targets[t]->shingles());
+		result.stats.preprocessNsA = query->preprocessNs;
+		result.stats.preprocessNsB = targets[t]->preprocessNs;
+		if (writer) {
+			std::ostringstream record;
+			writeResultJson(record, query->doc, targets[t]->doc, result,
+				"\"target\":\"" + jsonEscape(files[t + 1]) + "\",\"index\":" + std::to_string(t) + ",");
+			std::string json = record.str();
+			writer->write(json.substr(1, json.size() - 2));
+		}
+		std::lock_guard<std::mutex> lock(heapMutex);
+		results[t] = std::move(result);
+		scored[t] = true;
+		fullComparisons++;
+		if (topK <= 0) return;
+		heap.push_back(t);
+		std::push_heap(heap.begin(), heap.end(), weaker);
+		if ((int)heap.size() > topK) {
+			std::pop_heap(heap.begin(), heap.end(), weaker);
+			heap.pop_back();
+		}
+	});
+
+	std::vector<int> reported;
+	if (topK > 0) {
+		reported = heap;
+	} else {
+		for (int t = 0; t < targetCount; ++t) if (scored[t]) reported.push_back(t);
+	}
+	std::sort(reported.begin(), reported.end(), weaker);
+
+	std::ostringstream topKJson;
+	topKJson << "\"topK\":{\"k\":" << topK << ",\"candidates\":" << targetCount
+		<< ",\"fullComparisons\":" << fullComparisons
+		<< ",\"skipped\":" << ((int)order.size() - fullComparisons) << "}";
+	if (writer) {
+		std::ostringstream done;
+		done << "\"done\":true,\"query\":\"" << jsonEscape(files[0]) << "\",\"ranking\":[";
+		for (size_t i = 0; i < reported.size(); ++i) done << (i ? "," : "") << reported[i];
+		done << "]," << topKJson.str();
+		writer->write(done.str());
+		return 0;
+	}
+
+	std::ostringstream out;
+	out << "{\"query\":\"" << jsonEscape(files[0]) << "\",\"results\":[";
+	for (size_t i = 0; i < reported.size(); ++i) {
+		int t = reported[i];
+		if (i) out << ",";
+		writeResultJson(out, query->doc, targets[t]->doc, results[t], "\"target\":\"" + jsonEscape(files[t + 1]) + "\",");
+	}
+	out << "],";
+	if (!unreadable.empty()) {
+		out << "\"errors\":[";
+		for (size_t i = 0; i < unreadable.size(); ++i) out << (i ? "," : "") << "{" << unreadableFields(unreadable[i]) << "}";
+		out << "],";
+	}
+	out << topKJson.str() << "}";
+	std::cout << out.str() << std::endl;
+	return 0;
+}
+
+// Resident set of the process in bytes (Linux), or 0 where it is not available
+static long long currentRssBytes() {
+#ifdef __linux__
+	std::ifstream statm("/proc/self/statm");
+	long long pages = 0, resident = 0;
+	if (statm >> pages >> resident) return resident * (long long)sysconf(_SC_PAGESIZE);
+#endif
+	return 0;
+}
+
+// Request counters and latency histograms for --serve, exposed in the Prometheus text format.
+// Only the serving thread records, with relaxed stores, so recording takes no lock and no
+// read-modify-write; the endpoint thread reads the counters on scrape.
+class ServeMetrics {
+public:
+	enum Status { ok, cached, error, statusCount };
+	// Latency histograms are kept per class of combined input size
+	static const int sizeClasses = 5;
+	static const int latencyBuckets = 13;
+
+private:
+	std::atomic<uint64_t> requests[statusCount] = {};
+	std::atomic<uint64_t> truncated{0};
+	std::atomic<uint64_t> limitsHit{0};
+	std::atomic<uint64_t> buckets[sizeClasses][latencyBuckets + 1] = {};  // not cumulative; last is +Inf
+	std::atomic<uint64_t> sumNs[sizeClasses] = {};
+
+	static void bump(std::atomic<uint64_t> &c, uint64_t by = 1) {
+		c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+	}
+
+	static int sizeClassOf(size_t bytes) {
+		size_t bound = 10 << 10;
+		int c = 0;
+		while (c + 1 < sizeClasses && bytes > bound) bound *= 10, c++;
+		return c;
+	}
+
+public:
+	static constexpr double latencyBounds[latencyBuckets] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+	static constexpr const char *sizeLabels[sizeClasses] = {"10KB", "100KB", "1MB", "10MB", "larger"};
+
+	// Gauges owned by the serving thread; requests are compared one at a time, so busy is 0 or 1
+	std::atomic<long long> busy{0};
+	std::atomic<long long> scratchBytes{0};
+
+	void observe(Status status, size_t inputBytes, long long ns, bool wasTruncated, bool hitLimits) {
+		bump(requests[status]);
+		if (status == error) return;
+		if (wasTruncated) bump(truncated);
+		if (hitLimits) bump(limitsHit);
+		int c = sizeClassOf(inputBytes);
+		double seconds = ns / 1e9;
+		int b = 0;
+		while (b < latencyBuckets && seconds > latencyBounds[b]) b++;
+		bump(buckets[c][b]);
+		bump(sumNs[c], (uint64_t)std::max(0LL, ns));
+	}
+
+	void render(std::ostream &out, DocumentCache &docs, ResultCache &cache) {
+		static const char *statusLabels[statusCount] = {"ok", "cached", "error"};
+		out << "# HELP cpp_checker_requests_total Comparison requests by outcome.\n# TYPE cpp_checker_requests_total counter\n";
+		for (int i = 0; i < statusCount; ++i) out << "cpp_checker_requests_total{status=\"" << statusLabels[i] << "\"} " << requests[i].load(std::memory_order_relaxed) << "\n";
+		out << "# HELP cpp_checker_truncated_total Results cut short by the time budget.\n# TYPE cpp_checker_truncated_total counter\n"
+			<< "cpp_checker_truncated_total " << truncated.load(std::memory_order_relaxed) << "\n";
+		out << "# HELP cpp_checker_limits_hit_total Results that ran into the occurrence or span caps.\n# TYPE cpp_checker_limits_hit_total counter\n"
+			<< "cpp_checker_limits_hit_total " << limitsHit.load(std::memory_order_relaxed) << "\n";
+		out << "# HELP cpp_checker_request_duration_seconds Request latency by combined input size.\n"
+			<< "# TYPE cpp_checker_request_duration_seconds histogram\n";
+		for (int c = 0; c < sizeClasses; ++c) {
+			uint64_t cumulative = 0;
+			for (int b = 0; b <= latencyBuckets; ++b) {
+				cumulative += buckets[c][b].load(std::memory_order_relaxed);
+				out << "cpp_checker_request_duration_seconds_bucket{size=\"" << sizeLabels[c] << "\",le=\"";
+				if (b < latencyBuckets) out << latencyBounds[b];
+				else out << "+Inf";
+				out << "\"} " << cumulative << "\n";
+			}
+			out << "cpp_checker_request_duration_seconds_sum{size=\"" << sizeLabels[c] << "\"} " << sumNs[c].load(std::memory_order_relaxed) / 1e9 << "\n"
+				<< "cpp_checker_request_duration_seconds_count{size=\"" << sizeLabels[c] << "\"} " << cumulative << "\n";
+		}
+		auto docUsage = docs.usage();
+		auto resultUsage = cache.usage();
+		out << "# HELP cpp_checker_document_cache_requests_total Document cache lookups by result.\n"
+			<< "# TYPE cpp_checker_document_cache_requests_total counter\n"
+			<< "cpp_checker_document_cache_requests_total{result=\"hit\"} " << docs.hits << "\n"
+			<< "cpp_checker_document_cache_requests_total{result=\"miss\"} " << docs.misses << "\n"
+			<< "# TYPE cpp_checker_document_cache_evictions_total counter\n"
+			<< "cpp_checker_document_cache_evictions_total " << docs.evictions << "\n"
+			<< "# TYPE cpp_checker_document_cache_bytes gauge\ncpp_checker_document_cache_bytes " << docUsage.second << "\n"
+			<< "# TYPE cpp_checker_document_cache_entries gauge\ncpp_checker_document_cache_entries " << docUsage.first << "\n";
+		out << "# HELP cpp_checker_result_cache_requests_total Result cache lookups by result.\n"
+			<< "# TYPE cpp_checker_result_cache_requests_total counter\n"
+			<< "cpp_checker_result_cache_requests_total{result=\"hit\"} " << cache.hits << "\n"
+			<< "cpp_checker_result_cache_requests_total{result=\"disk_hit\"} " << cache.diskHits << "\n"
+			<< "cpp_checker_result_cache_requests_total{result=\"miss\"} " << cache.misses << "\n"
+			<< "# TYPE cpp_checker_result_cache_bytes gauge\ncpp_checker_result_cache_bytes " << resultUsage.second << "\n"
+			<< "# TYPE cpp_checker_result_cache_entries gauge\ncpp_checker_result_cache_entries " << resultUsage.first << "\n";
+		out << "# HELP cpp_checker_busy 1 while a request is being compared, else 0.\n# TYPE cpp_checker_busy gauge\n"
+			<< "cpp_checker_busy " << busy << "\n";
+		out << "# HELP cpp_checker_scratch_bytes Bytes held by the reusable checker buffers.\n# TYPE cpp_checker_scratch_bytes gauge\n"
+			<< "cpp_checker_scratch_bytes " << scratchBytes << "\n";
+		out << "# TYPE cpp_checker_resident_memory_bytes gauge\ncpp_checker_resident_memory_bytes " << currentRssBytes() << "\n"
+			<< "# TYPE cpp_checker_peak_resident_memory_bytes gauge\ncpp_checker_peak_resident_memory_bytes " << peakRssBytes() << "\n";
+	}
+};
+
+constexpr double ServeMetrics::latencyBounds[];
+constexpr const char *ServeMetrics::sizeLabels[];
+
+// Answers HTTP GET /metrics on a loopback TCP port or a Unix socket from a background thread,
+// one connection at a time. The endpoint is optional and POSIX only.
+class MetricsEndpoint {
+private:
+	int listenFd = -1;
+	std::string socketPath;  // removed again on stop()
+	std::atomic<bool> stopping{false};
+	std::thread server;
+
+	void serve(const std::function<std::string()> &render) {
+		while (!stopping.load()) {
+#ifndef _WIN32
+			// Wake up regularly so stop() does not depend on the platform interrupting accept()
+			pollfd pfd{listenFd, POLLIN, 0};
+			if (poll(&pfd, 1, 100) <= 0) continue;
+			int fd = accept(listenFd, nullptr, nullptr);
+			if (fd < 0) continue;
+			timeval timeout{1, 0};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+			std::string request;
+			char buf[1024];
+			while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+				ssize_t n = recv(fd, buf, sizeof buf, 0);
+				if (n <= 0) break;
+				request.append(buf, (size_t)n);
+			}
+			std::string path = request.substr(0, request.find("\r\n"));
+			bool found = path.rfind("GET /metrics", 0) == 0 || path.rfind("GET / ", 0) == 0;
+			std::string body = found ? render() : "not found\n";
+			std::string response = std::string(found ? "HTTP/1.1 200 OK" : "HTTP/1.1 404 Not Found")
+				+ "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size())
+				+ "\r\nConnection: close\r\n\r\n" + body;
+			for (size_t sent = 0; sent < response.size();) {
+				ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+				if (n <= 0) break;
+				sent += (size_t)n;
+			}
+			close(fd);
+#endif
+		}
+	}
+
+public:
+	~MetricsEndpoint() { stop(); }
+
+	// `address` is a port number (bound to 127.0.0.1) or a Unix socket path
+	bool start(const std::string &address, std::function<std::string()> render, std::string &error) {
+#ifdef _WIN32
+		error = "the metrics endpoint is not supported on Windows";
+		return false;
+#else
+		bool isPort = !address.empty() && address.find_first_not_of("0123456789") == std::string::npos;
+		listenFd = socket(isPort ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd < 0) {
+			error = "cannot create socket";
+			return false;
+		}
+		int bound;
+		if (isPort) {
+			int one = 1;
+			setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+			sockaddr_in addr{};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons((uint16_t)std::atoi(address.c_str()));
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			bound = bind(listenFd, (sockaddr *)&addr, sizeof addr);
+		} else {
+			sockaddr_un addr{};
+			addr.sun_family = AF_UNIX;
+			if (address.size() >= sizeof addr.sun_path) {
+				error = "socket path too long";
+				close(listenFd);
+				listenFd = -1;
+				return false;
+			}
+			std::memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+			unlink(address.c_str());
+			bound = bind(listenFd, (sockaddr *)&addr, sizeof addr);
+			if (bound == 0) socketPath = address;
+		}
+		if (bound != 0 || listen(listenFd, 16) != 0) {
+			error = "cannot listen on " + address;
+			close(listenFd);
+			listenFd = -1;
+			return false;
+		}
+		server = std::thread([this, render] { serve(render); });
+		return true;
+#endif
+	}
+
+	void stop() {
+		stopping.store(true);
+		if (server.joinable()) server.join();
+#ifndef _WIN32
+		if (listenFd >= 0) close(listenFd);
+		if (!socketPath.empty()) unlink(socketPath.c_str());
+#endif
+		listenFd = -1;
+		socketPath.clear();
+	}
+};
+
+// Long-running mode: reads one request per line ("<fileA>\t<fileB>") from stdin and answers each
+// with one JSON line, keeping the document and result caches warm across requests. A line
+// reading "stats" reports cache counters, the bytes held by the checker buffers and arena
+// allocation counts instead. With `metricsAddress` set, request metrics are also served in the
+// Prometheus text format (see MetricsEndpoint).
+static int runServe(int threads, const CompareLimits &limits, bool stats, const std::string &metricsAddress,
+		DocumentCache &docs, ResultCache &cache) {
+	WorkerContext ctx;
+	ctx.rk.setThreads(threads);
+	ctx.limits = limits;
+	ctx.collectStats = stats;
+	ServeMetrics metrics;
+	MetricsEndpoint endpoint;
+	if (!metricsAddress.empty()) {
+		std::string error;
+		auto render = [&] {
+			std::ostringstream out;
+			metrics.render(out, docs, cache);
+			return out.str();
+		};
+		if (!endpoint.start(metricsAddress, render, error)) {
+			std::cerr << "cpp_checker: metrics: " << error << std::endl;
+			return 1;
+		}
+	}
+	long long requests = 0;
+	std::string line;
+	while (std::getline(std::cin, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty()) continue;
+		if (line == "stats") {
+			std::cout << "{\"documentCache\":";
+			docs.writeStatsJson(std::cout);
+			std::cout << ",\"resultCache\":{\"hits\":" << cache.hits << ",\"diskHits\":" << cache.diskHits
+				<< ",\"misses\":" << cache.misses << "},\"scratchBytes\":" << ctx.scratchBytes();
+			ArenaCounts arena = ctx.arenaCounts();
+			std::cout << ",\"arena\":{\"allocations\":" << arena.allocations << ",\"heapChunks\":" << arena.chunkAllocations << "}}" << std::endl;
+			continue;
+		}
+		size_t tab = line.find('\t');
+		if (tab == std::string::npos) {
+			metrics.observe(ServeMetrics::error, 0, 0, false, false);
+			std::cout << "{\"error\":\"expected <fileA>\\t<fileB>\"}" << std::endl;
+			continue;
+		}
+		TraceScope span("request", "request", requests++);
+		long long started = monotonicNs();
+		metrics.busy = 1;
+		std::string pathA = line.substr(0, tab), pathB = line.substr(tab + 1);
+		auto a = docs.load(pathA);
+		auto b = docs.load(pathB);
+		PairOutcome outcome;
+		std::cout << pairJson(pathA, a.get(), pathB, b.get(), ctx, &cache, &outcome) << std::endl;
+		metrics.busy = 0;
+		if (!a || !b) {
+			metrics.observe(ServeMetrics::error, 0, 0, false, false);
+			continue;
+		}
+		metrics.scratchBytes = (long long)ctx.scratchBytes();
+		metrics.observe(outcome.cached ? ServeMetrics::cached : ServeMetrics::ok, a->doc.raw.size() + b->doc.raw.size(),
+			monotonicNs() - started, outcome.truncated, outcome.limitsHit);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int threads = 0;
+	int topK = 0;
+	bool corpus = false;
+	bool serve = false;
+	bool stream = false;
+	bool stats = false;
+	TokenMode mode = TokenMode::chars;
+	CodeLanguage language = CodeLanguage::cFamily;
+	bool languageFixed = false;
+	CompareLimits limits;
+	std::string manifest;
+	std::string tracePath;
+	std::string metricsAddress;
+	std::string cacheDir;
+	size_t cacheBytes = 64u << 20;
+	size_t cacheDirBytes = (size_t)256 << 20;
+	size_t docCacheBytes = (size_t)256 << 20;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--capabilities") {
+			// Lets a wrapper check which options this build understands before passing them
+			std::cout << "{\"features\":[\"threads\",\"top-k\",\"corpus\",\"serve\",\"metrics\",\"trace\",\"stream\",\"manifest\",\"stats\","
+				<< "\"timeout-ms\",\"max-occurrences\",\"max-spans\",\"max-edits\",\"mode\",\"lang\",\"cache-dir\",\"cache-dir-bytes\","
+				<< "\"cache-bytes\",\"doc-cache-bytes\",\"highlights\"]}" << std::endl;
+			return 0;
+		} else if (arg == "--threads" && i + 1 < argc) {
+			threads = std::atoi(argv[++i]);
+		} else if (arg == "--top-k" && i + 1 < argc) {
+			topK = std::atoi(argv[++i]);
+		} else if (arg == "--corpus") {
+			corpus = true;
+		} else if (arg == "--serve") {
+			serve = true;
+		} else if (arg == "--timeout-ms" && i + 1 < argc) {
+			limits.timeoutMs = std::atoi(argv[++i]);
+		} else if (arg == "--max-occurrences" && i + 1 < argc) {
+			limits.maxOccurrences = std::atoi(argv[++i]);
+		} else if (arg == "--max-spans" && i + 1 < argc) {
+			limits.maxSpans = std::atoi(argv[++i]);
+		} else if (arg == "--max-edits" && i + 1 < argc) {
+			limits.maxEdits = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--stream") {
+			stream = true;
+		} else if (arg == "--stats") {
+			stats = true;
+		} else if (arg == "--mode" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name != "char" && name != "word" && name != "code") {
+				std::cerr << "cpp_checker: unknown mode " << name << " (char, word or code)" << std::endl;
+				return 1;
+			}
+			mode = name == "word" ? TokenMode::words : name == "code" ? TokenMode::code : TokenMode::chars;
+		} else if (arg == "--lang" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name != "c" && name != "python") {
+				std::cerr << "cpp_checker: unknown language " << name << " (c or python)" << std::endl;
+				return 1;
+			}
+			language = name == "python" ? CodeLanguage::python : CodeLanguage::cFamily;
+			languageFixed = true;
+		} else if (arg == "--trace" && i + 1 < argc) {
+			tracePath = argv[++i];
+		} else if (arg == "--metrics" && i + 1 < argc) {
+			metricsAddress = argv[++i];
+		} else if (arg == "--manifest" && i + 1 < argc) {
+			manifest = argv[++i];
+		} else if (arg == "--cache-dir" && i + 1 < argc) {
+			cacheDir = argv[++i];
+		} else if (arg == "--cache-bytes" && i + 1 < argc) {
+			cacheBytes = (size_t)std::atoll(argv[++i]);
+		} else if (arg == "--cache-dir-bytes" && i + 1 < argc) {
+			cacheDirBytes = (size_t)std::atoll(argv[++i]);
+		} else if (arg == "--doc-cache-bytes" && i + 1 < argc) {
+			docCacheBytes = (size_t)std::atoll(argv[++i]);
+		} else {
+			files.push_back(arg);
+		}
+	}
+	if (threads <= 0) threads = defaultThreadCount();
+	// The trace is written on every way out of main, after the workers of the run have stopped
+	struct TraceOutput {
+		const std::string &path;
+		std::unique_ptr<TraceRecorder> recorder;
+		~TraceOutput() {
+			if (!recorder) return;
+			tracer = nullptr;
+			if (!recorder->write(path)) std::cerr << "cpp_checker: cannot write trace " << path << std::endl;
+		}
+	} trace{tracePath, nullptr};
+	if (!tracePath.empty()) {
+		trace.recorder.reset(new TraceRecorder());
+		tracer = trace.recorder.get();
+	}
+	Vocabulary vocabulary;
+	DocumentCache docs(docCacheBytes);
+	docs.setTokenMode(mode, &vocabulary);
+	if (languageFixed) docs.setCodeLanguage(language);
+	if (serve) {
+		ResultCache cache(cacheBytes, cacheDir, cacheDirBytes);
+		return runServe(threads, limits, stats, metricsAddress, docs, cache);
+	}
+	// One-shot runs report what they have on the first interrupt; a second one terminates
+	for (int sig : {SIGINT, SIGTERM}) {
+		std::signal(sig, [](int received) {
+			cancelAll.store(true, std::memory_order_relaxed);
+			std::signal(received, SIG_DFL);
+		});
+	}
+	if (!manifest.empty()) {
+		std::string error;
+		bool ok;
+		if (manifest == "-") {
+			ok = readManifest(std::cin, files, error);
+		} else {
+			std::ifstream in(manifest);
+			if (!in) error = "cannot open " + manifest;
+			ok = in && readManifest(in, files, error);
+		}
+		if (!ok || files.empty()) {
+			std::cerr << "cpp_checker: manifest " << (error.empty() ? "lists no pairs" : error) << std::endl;
+			return 1;
+		}
+	}
+	if (files.size() < 2 || (!corpus && files.size() % 2 != 0)) {
+		std::cerr << "Usage: cpp_checker [--mode char|word|code [--lang c|python]] [--stream] [--stats] [--trace OUT.json] [--threads N] [--timeout-ms MS] [--max-occurrences N] [--max-spans N] [--max-edits N] [--cache-dir DIR [--cache-dir-bytes N]] <file1> <file2> [<file1> <file2> ...]" << std::endl;
+		std::cerr << "       cpp_checker --corpus [--stream] [--top-k K] [--threads N] <query> <target> [<target> ...]" << std::endl;
+		std::cerr << "       cpp_checker --manifest FILE|- [--stream] [--threads N] [--cache-dir DIR]   (\"fileA<TAB>fileB\", \"query\" or \"<TAB>target\" lines)" << std::endl;
+		std::cerr << "       cpp_checker --serve [--metrics PORT|SOCKET] [--cache-dir DIR [--cache-dir-bytes N]] [--cache-bytes N] [--doc-cache-bytes N]   (reads \"fileA<TAB>fileB\" lines)" << std::endl;
+		std::cerr << "       cpp_checker --capabilities   (lists the supported options as JSON)" << std::endl;
+		return 1;
+	}
+
+	if (corpus) return runCorpus(files, threads, topK, stream, limits, stats, docs);
+	// Without a directory there is nothing to reuse across one-shot runs
+	std::unique_ptr<ResultCache> cache;
+	if (!cacheDir.empty()) cache.reset(new ResultCache(cacheBytes, cacheDir, cacheDirBytes));
+	if (stream || !manifest.empty() || files.size() > 2) {
+		return runBatch(files, !manifest.empty(), stream, threads, limits, stats, docs, cache.get());
+	}
+
+	// Single pair: keep the original output shape and stay on the calling thread
+	TraceScope span("pair", "pair", 0);
+	auto a = docs.load(files[0]);
+	auto b = docs.load(files[1]);
+	WorkerContext ctx;
+	// All threads go to the one comparison
+	ctx.rk.setThreads(threads);
+	ctx.limits = limits;
+	ctx.collectStats = stats;
+	std::cout << pairJson(files[0], a.get(), files[1], b.get(), ctx, cache.get()) << std::endl;
+	return a && b ? 0 : 1;
+}
+#endif
@@ -0,0 +1,572 @@
+// Regression tests for the checker internals.
+//
+//   g++ -O2 -pthread -o tests cpp_checker/tests.cpp
+//   ./tests [NAME]
+//
+// Each test prints one line per failed check; the run exits non-zero if any check failed.
+#define CPP_CHECKER_NO_MAIN
+#include "main.cpp"
+
+#include <cstdio>
+#include <random>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++failures; \
+		} \
+	} while (0)
+
+static std::vector<uint32_t> lexTokens(const std::string &source, CodeLanguage language) {
+	Document doc(source);
+	doc.tokenizeCode(language);
+	return doc.tokens;
+}
+
+// `//` is floor division in Python, so text after it is code; `#` still starts a comment
+static void testPythonFloorDivision() {
+	std::vector<uint32_t> a = lexTokens("q = a // b + c\n", CodeLanguage::python);
+	std::vector<uint32_t> b = lexTokens("q = a // b - c\n", CodeLanguage::python);
+	CHECK(a.size() == 7);
+	CHECK(a != b);
+	CHECK(lexTokens("q = a  # b + c\n", CodeLanguage::python) == lexTokens("q = a\n", CodeLanguage::python));
+	CHECK(lexTokens("n //= 2\n", CodeLanguage::python).size() == 3);
+	// The C family keeps `//` and `/* */` comments
+	CHECK(lexTokens("q = a // b + c\n", CodeLanguage::cFamily) == lexTokens("q = a\n", CodeLanguage::cFamily));
+	CHECK(lexTokens("q = a /* b */ + c;\n", CodeLanguage::cFamily) == lexTokens("q = a + c;\n", CodeLanguage::cFamily));
+}
+
+static void testLanguageOfPath() {
+	CHECK(CodeLexer::languageOf("src/solver.py") == CodeLanguage::python);
+	CHECK(CodeLexer::languageOf("STUBS.PYI") == CodeLanguage::python);
+	CHECK(CodeLexer::languageOf("main.cpp") == CodeLanguage::cFamily);
+	CHECK(CodeLexer::languageOf("notes.txt") == CodeLanguage::cFamily);
+}
+
+// Textbook O(la * lb) dynamic program the bit-parallel LCS is checked against
+static int referenceLcs(const std::string &a, const std::string &b) {
+	std::vector<int> prev(b.size() + 1), cur(b.size() + 1);
+	for (size_t i = 1; i <= a.size(); ++i) {
+		for (size_t j = 1; j <= b.size(); ++j) cur[j] = a[i - 1] == b[j - 1] ? prev[j - 1] + 1 : std::max(prev[j], cur[j - 1]);
+		std::swap(prev, cur);
+	}
+	return prev[b.size()];
+}
+
+// Random strings over small alphabets, across the one-word and multi-word paths
+static void testBitParallelLcs() {
+	std::mt19937 rng(5);
+	BitParallelLcs lcs;
+	for (int t = 0; t < 3000; ++t) {
+		int la = (int)(rng() % 300), lb = (int)(rng() % 300), alphabet = 2 + (int)(rng() % 5);
+		std::string a, b;
+		for (int i = 0; i < la; ++i) a += (char)('a' + rng() % alphabet);
+		for (int i = 0; i < lb; ++i) b += (char)('a' + rng() % alphabet);
+		int expected = referenceLcs(a, b);
+		CHECK(lcs.length(a.data(), la, b.data(), lb) == expected);
+		if (la + lb > 0) CHECK(lcs.ratio(a.data(), la, b.data(), lb) == 2.0 * expected / (la + lb));
+	}
+}
+
+// The range starts and ends on matched characters and still holds a longest common subsequence
+static void testAlignedRange() {
+	std::mt19937 rng(11);
+	BitParallelLcs lcs;
+	for (int t = 0; t < 1000; ++t) {
+		int la = 1 + (int)(rng() % 7), lb = 1 + (int)(rng() % 200), alphabet = 2 + (int)(rng() % 8);
+		std::string a, b;
+		for (int i = 0; i < la; ++i) a += (char)('a' + rng() % alphabet);
+		for (int i = 0; i < lb; ++i) b += (char)('a' + rng() % alphabet);
+		int startA, endA, startB, endB;
+		lcs.alignedRange(a.data(), la, b.data(), lb, startA, endA, startB, endB);
+		int expected = referenceLcs(a, b);
+		if (expected == 0) {
+			CHECK(endA == startA && endB == startB);
+			continue;
+		}
+		CHECK(0 <= startA && startA < endA && endA <= la);
+		CHECK(0 <= startB && startB < endB && endB <= lb);
+		CHECK(a[startA] == b[startB] && a[endA - 1] == b[endB - 1]);
+		CHECK(referenceLcs(a.substr(startA, endA - startA), b.substr(startB, endB - startB)) == expected);
+	}
+	// Whitespace matched at the ends is left out
+	int startA, endA, startB, endB;
+	lcs.alignedRange("hello\n", 6, "say hallo there\n", 16, startA, endA, startB, endB);
+	CHECK(startA == 0 && endA == 5 && startB == 4 && endB == 9);
+}
+
+// Token shingles keep all 64 hash bits, so shingles of large batches do not collide
+static void testTokenShingleWidth() {
+	// 200k distinct words give about as many distinct shingles, enough for some of them to agree in
+	// their low 32 bits; a 32-bit hash would merge those
+	std::string text;
+	for (int i = 0; i < 200000; ++i) text += "w" + std::to_string(i) + (i % 9 == 8 ? ".\n" : " ");
+	Vocabulary vocabulary;
+	Document doc(text);
+	doc.tokenizeWords(vocabulary);
+	std::vector<uint64_t> shingles;
+	JaccardChecker::makeTokenShingles(doc, shingles);
+	CHECK(shingles.size() == doc.tokens.size() - JaccardChecker::tokenShingleSize(TokenMode::words) + 1);
+	CHECK(std::any_of(shingles.begin(), shingles.end(), [](uint64_t h) { return h > UINT32_MAX; }));
+	std::vector<uint32_t> low(shingles.begin(), shingles.end());
+	std::sort(low.begin(), low.end());
+	CHECK(std::adjacent_find(low.begin(), low.end()) != low.end());
+}
+
+// Every task of a run is executed exactly once, across repeated runs on the same pool
+static void testPoolRunsEachTaskOnce() {
+	WorkStealingPool pool(4);
+	for (int round = 0; round < 3; ++round) {
+		int n = 1000 + round;
+		std::vector<std::atomic<int>> runs(n);
+		std::vector<int> order(n);
+		for (int i = 0; i < n; ++i) order[i] = n - 1 - i;
+		pool.run(order, [&](int task, int) { runs[task]++; });
+		CHECK(std::all_of(runs.begin(), runs.end(), [](const std::atomic<int> &c) { return c.load() == 1; }));
+	}
+	pool.run({}, [&](int, int) { ++failures; });
+}
+
+// Tasks are dealt round-robin; when all slow ones land on worker 0, the others steal them
+static void testPoolStealsSkewedWork() {
+	WorkStealingPool pool(4);
+	std::vector<int> order(40), worker(order.size(), -1);
+	for (int i = 0; i < (int)order.size(); ++i) order[i] = i;
+	pool.run(order, [&](int task, int w) {
+		if (task % 4 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		worker[task] = w;
+	});
+	bool stolen = false;
+	for (int i = 0; i < (int)order.size(); i += 4) stolen |= worker[i] != 0;
+	CHECK(stolen);
+}
+
+static std::string randomWords(std::mt19937 &rng, int count) {
+	std::string text;
+	for (int i = 0; i < count; ++i) text += "w" + std::to_string(rng() % 300) + (rng() % 12 == 0 ? ".\n" : " ");
+	return text;
+}
+
+// Scoring a batch of pairs through the pool gives the same results with one worker as with several
+static void testPoolDeterminism() {
+	std::mt19937 rng(3);
+	std::vector<Document> as, bs;
+	for (int i = 0; i < 24; ++i) {
+		std::string a = randomWords(rng, 200 + (int)(rng() % 400));
+		std::string b = randomWords(rng, 100) + a.substr(0, a.size() * (rng() % 100) / 100) + randomWords(rng, 100);
+		as.emplace_back(a);
+		bs.emplace_back(b);
+	}
+	auto score = [&](int threads) {
+		WorkStealingPool pool(threads);
+		std::vector<WorkerContext> contexts(pool.size());
+		std::vector<PairResult> results(as.size());
+		std::vector<int> order(as.size());
+		for (int i = 0; i < (int)order.size(); ++i) order[i] = i;
+		pool.run(order, [&](int t, int w) { results[t] = comparePair(as[t], bs[t], contexts[w]); });
+		return results;
+	};
+	std::vector<PairResult> one = score(1), many = score(4);
+	for (size_t i = 0; i < one.size(); ++i) {
+		CHECK(one[i].localScore == many[i].localScore);
+		CHECK(one[i].spans.size() == many[i].spans.size());
+		CHECK(one[i].highlights.size() == many[i].highlights.size());
+		for (size_t k = 0; k < std::min(one[i].highlights.size(), many[i].highlights.size()); ++k) {
+			CHECK(one[i].highlights[k].rawStartA == many[i].highlights[k].rawStartA);
+			CHECK(one[i].highlights[k].rawStartB == many[i].highlights[k].rawStartB);
+		}
+	}
+	CHECK(std::any_of(one.begin(), one.end(), [](const PairResult &r) { return r.localScore > 0; }));
+}
+
+// A missing file or a directory is reported as unreadable rather than loaded as an empty document
+static void testUnreadableFiles() {
+	std::string path = (std::filesystem::temp_directory_path() / "cpp_checker_tests_readable.txt").string();
+	std::ofstream(path) << "some text\n";
+	std::string content = "unchanged";
+	CHECK(!Document::readFile("/nonexistent/cpp_checker_tests.txt", content));
+	CHECK(!Document::readFile(std::filesystem::temp_directory_path().string(), content));
+	CHECK(content == "unchanged");
+	CHECK(Document::readFile(path, content) && content == "some text\n");
+	DocumentCache docs(1 << 20);
+	CHECK(docs.load("/nonexistent/cpp_checker_tests.txt") == nullptr);
+	CHECK(docs.load(path) != nullptr);
+	CHECK(docs.usage().first == 1);
+	std::filesystem::remove(path);
+}
+
+static Hash128 cacheKey(int i) {
+	return hash128(&i, sizeof(i));
+}
+
+// The memory tier drops the least recently used entry once over its byte budget; a hit refreshes it
+static void testResultCacheEviction() {
+	std::string value(100, 'x');
+	ResultCache cache(3 * (value.size() + 96));
+	std::string out;
+	for (int i = 0; i < 3; ++i) cache.put(cacheKey(i), value);
+	CHECK(cache.get(cacheKey(0), out) && out == value);
+	cache.put(cacheKey(3), value);
+	CHECK(cache.usage().first == 3);
+	CHECK(!cache.get(cacheKey(1), out));
+	CHECK(cache.get(cacheKey(0), out) && cache.get(cacheKey(2), out) && cache.get(cacheKey(3), out));
+	// An entry larger than the whole budget is not kept
+	cache.put(cacheKey(4), std::string(1000, 'y'));
+	CHECK(!cache.get(cacheKey(4), out));
+	CHECK(cache.usage().first == 3);
+}
+
+// The disk tier stays under its byte budget and is private to the owner
+static void testResultCacheDiskBudget() {
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / "cpp_checker_tests_cache";
+	std::filesystem::remove_all(dir);
+	{
+		ResultCache cache(0, dir.string(), 1000);
+		for (int i = 0; i < 40; ++i) cache.put(cacheKey(i), std::string(100, 'x'));
+		std::string out;
+		CHECK(cache.get(cacheKey(39), out) && out == std::string(100, 'x'));
+		CHECK(!cache.get(cacheKey(0), out));
+	}
+	size_t bytes = 0, files = 0;
+	for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+		bytes += entry.file_size();
+		files++;
+	}
+	CHECK(files > 0 && bytes <= 1000);
+	CHECK((std::filesystem::status(dir).permissions() & std::filesystem::perms::all) == std::filesystem::perms::owner_all);
+	std::filesystem::remove_all(dir);
+}
+
+// Documents are evicted least recently used first once the cache is over its byte budget
+static void testDocumentCacheEviction() {
+	auto text = [](int i) { return std::string(2000, (char)('a' + i)) + "\n"; };
+	size_t cost;
+	{
+		DocumentCache probe(1 << 20);
+		probe.get(text(0));
+		cost = probe.usage().second;
+	}
+	DocumentCache docs(cost * 5 / 2);
+	auto first = docs.get(text(0));
+	docs.get(text(1));
+	CHECK(docs.get(text(0)) == first);
+	docs.get(text(2));
+	CHECK(docs.usage().first == 2);
+	CHECK(docs.evictions == 1);
+	long long misses = docs.misses;
+	CHECK(docs.get(text(0)) == first);
+	docs.get(text(1));
+	CHECK(docs.misses == misses + 1);
+	// The same text is one entry per language in the code mode only
+	CHECK(docs.get(text(2), CodeLanguage::python) == docs.get(text(2), CodeLanguage::cFamily));
+}
+
+static MatchSpan seedSpan(int startA, int endA, int startB, int endB, int line = 1) {
+	return {startA, endA, startB, endB, std::string(), std::string(), line, line};
+}
+
+// Seeds grow to the maximal exact run, overlaps in B fold into one span, and close neighbours on
+// the same lines merge; raw offsets and slices come from the unprocessed text
+static void testFinalizeSpans() {
+	Document a("hello world foo bar\n"), b("hello world foo bar\n");
+	std::vector<MatchSpan> spans = {seedSpan(4, 8, 4, 8), seedSpan(2, 5, 2, 5)};
+	finalizeSpans(a, b, spans);
+	CHECK(spans.size() == 1);
+	CHECK(spans[0].startA == 0 && spans[0].endA == 20 && spans[0].rawEndB == 20);
+	CHECK(spans[0].textA == a.raw && spans[0].textB == b.raw);
+
+	// Collapsed whitespace maps back to the raw run it stands for
+	Document c("Hello   World\n"), d("hello world\n");
+	spans = {seedSpan(0, 5, 0, 5)};
+	finalizeSpans(c, d, spans);
+	CHECK(spans.size() == 1);
+	CHECK(spans[0].rawStartA == 0 && spans[0].rawEndA == 14 && spans[0].textA == c.raw);
+
+	// Two runs 2 characters apart on one line pair become one span
+	Document e("abcdef XY ghijkl\n"), f("abcdef ZW ghijkl\n");
+	spans = {seedSpan(9, 12, 9, 12), seedSpan(0, 3, 0, 3)};
+	finalizeSpans(e, f, spans);
+	CHECK(spans.size() == 1);
+	CHECK(spans[0].rawStartB == 0 && spans[0].rawEndB == 17);
+
+	// Runs on different lines stay apart
+	Document g("same text one\nother\nsame text two\n"), h("same text one.\nsame text two\n");
+	spans = {seedSpan(0, 9, 0, 9, 1), {20, 29, 15, 24, std::string(), std::string(), 3, 2}};
+	finalizeSpans(g, h, spans);
+	CHECK(spans.size() == 2);
+	CHECK(spans[0].textA == "same text one" && spans[1].textA == "\nsame text two\n");
+}
+
+// Sentences match after per-line normalisation and report the raw range they came from
+static void testSentenceMatcher() {
+	Document a("First sentence here. The quick brown fox jumps.\nOk. Other line.\n");
+	Document b("Unrelated text.\nthe  QUICK brown fox jumps.\nOk.\n");
+	SentenceMatcher matcher;
+	std::vector<Highlight> out;
+	matcher.match(a, b, CancelToken::unlimited(), out);
+	// "Ok." is shorter than SentenceMatcher::minLength and does not match on its own
+	CHECK(out.size() == 1);
+	if (out.size() != 1) return;
+	const Highlight &h = out[0];
+	CHECK(a.raw.substr(h.rawStartA, h.rawEndA - h.rawStartA) == "The quick brown fox jumps.");
+	CHECK(b.raw.substr(h.rawStartB, h.rawEndB - h.rawStartB) == "the  QUICK brown fox jumps.");
+	CHECK(h.lineA == 1 && h.lineB == 2);
+	CHECK(std::strcmp(h.matchType, "sentence") == 0);
+}
+
+// Equal runs of at least ParagraphAligner::minRun characters are reported, and runs split by a
+// little punctuation on both sides are merged
+static void testParagraphAligner() {
+	ParagraphAligner aligner;
+	std::vector<Highlight> out;
+	Document a("An opening paragraph that B does not share at all.\n\nThe committee approved the annual budget, after a long debate.\n");
+	Document b("Something else entirely goes first here.\n\nThe committee approved the annual budget -- after a long debate.\n");
+	aligner.align(a, b, CancelToken::unlimited(), out);
+	CHECK(out.size() == 1);
+	if (out.size() == 1) {
+		const Highlight &h = out[0];
+		CHECK(a.raw.compare(h.rawStartA, h.rawEndA - h.rawStartA, "The committee approved the annual budget, after a long debate.\n") == 0);
+		CHECK(b.raw.compare(h.rawStartB, h.rawEndB - h.rawStartB, "The committee approved the annual budget -- after a long debate.\n") == 0);
+		CHECK(std::strcmp(h.matchType, "paragraph") == 0);
+	}
+	Document c("short equal text\n"), d("short equal text\n");
+	aligner.align(c, d, CancelToken::unlimited(), out);
+	CHECK(out.empty());
+}
+
+static Highlight lineHighlight(int startA, int endA, int startB, int endB, int line, const char *type) {
+	Highlight h;
+	h.rawStartA = startA;
+	h.rawEndA = endA;
+	h.rawStartB = startB;
+	h.rawEndB = endB;
+	h.lineA = h.lineB = line;
+	h.matchType = type;
+	return h;
+}
+
+// Overlapping highlights on the same lines fold into one, preferring paragraphs, then length
+static void testHighlightDedup() {
+	std::vector<Highlight> items = {
+		lineHighlight(0, 40, 0, 40, 1, "exact"),
+		lineHighlight(0, 30, 0, 30, 1, "paragraph"),
+		lineHighlight(100, 120, 100, 120, 2, "exact"),
+		lineHighlight(100, 125, 102, 125, 2, "exact"),
+		lineHighlight(200, 220, 200, 220, 3, "exact"),
+		lineHighlight(200, 220, 215, 235, 3, "exact"),
+		lineHighlight(0, 40, 0, 40, 4, "exact"),
+	};
+	HighlightRefiner::dedup(items);
+	CHECK(items.size() == 5);
+	if (items.size() != 5) return;
+	CHECK(std::strcmp(items[0].matchType, "paragraph") == 0);
+	CHECK(items[1].rawStartB == 102 && items[1].rawEndB == 125);
+	CHECK(items[2].rawStartB == 200 && items[3].rawStartB == 215);
+	CHECK(items[4].lineB == 4);
+}
+
+// Reference union of ranges clipped to [0, length), one flag per position
+static int coveredPositions(const std::vector<std::pair<int, int>> &ranges, int length) {
+	std::vector<bool> covered(length, false);
+	for (const auto &rg : ranges) {
+		for (int i = std::max(rg.first, 0); i < std::min(rg.second, length); ++i) covered[i] = true;
+	}
+	return (int)std::count(covered.begin(), covered.end(), true);
+}
+
+// Coverage counts overlapping ranges once, on both the sweep and the bitmap path
+static void testCoverageUnion() {
+	std::vector<std::pair<int, int>> ranges = {{300, 400}, {0, 100}, {50, 200}};
+	CHECK(coveragePercent(ranges, 1000) == 30.0);
+	ranges = {{30, 40}, {0, 10}, {5, 20}};
+	CHECK(coveragePercent(ranges, 100) == 30.0);
+	ranges.clear();
+	CHECK(coveragePercent(ranges, 100) == 0.0);
+	std::mt19937 rng(7);
+	for (int t = 0; t < 500; ++t) {
+		int length = 1 + (int)(rng() % 2000);
+		int count = 1 + (int)(rng() % 60);
+		ranges.clear();
+		for (int i = 0; i < count; ++i) {
+			int s = (int)(rng() % length);
+			ranges.push_back({s, s + (int)(rng() % (length - s + 1))});
+		}
+		int expected = coveredPositions(ranges, length);
+		CHECK(coveragePercent(ranges, length) == (double)expected * 100.0 / (double)length);
+	}
+}
+
+// CRLF counts as one line break; lines, columns and sentences are indexed on the raw text
+static void testCrlfPositions() {
+	Document d("ab\r\ncd\r\n\r\nOne. Two\r\nx");
+	CHECK((d.rawLines == std::vector<int>{0, 4, 8, 10, 20}));
+	CHECK(d.lineOf(2) == 1 && d.lineOf(3) == 1 && d.lineOf(4) == 2 && d.lineOf(9) == 3 && d.lineOf(20) == 5);
+	CHECK(d.columnOf(5) == 2 && d.columnOf(15) == 6);
+	CHECK(d.sentenceOf(15) == d.sentenceOf(10) + 1);
+	// A lone \r breaks a line too, and columns count characters rather than bytes
+	Document e("h\xc3\xa9llo\rw\xc3\xb6rld");
+	CHECK(e.rawLines.size() == 2 && e.lineOf(7) == 2);
+	CHECK(e.columnOf(10) == 3);
+
+	// Spans found in the processed text map back to raw CRLF offsets
+	Document a("foo\r\nbar baz\r\n"), b("bar baz\n");
+	std::vector<MatchSpan> spans = {{5, 12, 0, 7, std::string(), std::string(), 2, 1}};
+	finalizeSpans(a, b, spans);
+	CHECK(spans.size() == 1);
+	if (spans.size() == 1) {
+		CHECK(spans[0].rawStartA == 5 && spans[0].rawEndA == 12 && spans[0].textA == "bar baz");
+		CHECK(a.lineOf(spans[0].rawStartA) == 2 && a.columnOf(spans[0].rawStartA) == 1);
+	}
+
+	// The same text with CRLF and LF line ends gives highlights on the same lines
+	Document crlf("The quick brown fox jumps over the lazy dog.\r\nSecond line here is long enough.\r\n");
+	Document lf("The quick brown fox jumps over the lazy dog.\nSecond line here is long enough.\n");
+	WorkerContext ctx;
+	PairResult r = comparePair(crlf, lf, ctx);
+	CHECK(!r.highlights.empty());
+	for (const Highlight &h : r.highlights) {
+		CHECK(h.lineStartA == h.lineStartB && h.lineEndA == h.lineEndB);
+		CHECK(crlf.columnOf(h.rawStartA) == lf.columnOf(h.rawStartB));
+	}
+}
+
+// An expired budget stops a stage early, and a pair compared past its budget is flagged truncated
+static void testCancellation() {
+	CancelToken token;
+	token.start(0);
+	CHECK(!token.expired() && !token.tripped());
+	token.start(1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	CHECK(!token.tripped());
+	CHECK(token.expired() && token.tripped());
+	unsigned tick = 0;
+	CHECK(token.poll(tick));
+
+	Document a("The quick brown fox jumps over the lazy dog.\n"), b("The quick brown fox jumps over the lazy dog.\n");
+	SentenceMatcher matcher;
+	std::vector<Highlight> out;
+	matcher.match(a, b, token, out);
+	CHECK(out.empty());
+	token.start(0);
+	CHECK(!token.tripped());
+	matcher.match(a, b, token, out);
+	CHECK(out.size() == 1);
+
+	std::mt19937 rng(9);
+	std::string big;
+	while (big.size() < (1u << 20)) big += "w" + std::to_string(rng() % 5000) + (rng() % 10 == 0 ? ".\n" : " ");
+	Document x(big), y(big.substr(big.size() / 3) + big.substr(0, big.size() / 3));
+	WorkerContext ctx;
+	ctx.limits.timeoutMs = 1;
+	PairResult r = comparePair(x, y, ctx);
+	CHECK(r.truncated);
+	ctx.limits.timeoutMs = 0;
+	r = comparePair(a, b, ctx);
+	CHECK(!r.truncated && r.localScore == 100.0);
+}
+
+// maxOccurrences skips k-grams repeated all over B and maxSpans caps what a stage records; both
+// report how often they cut in
+static void testCompareLimits() {
+	WorkerContext ctx;
+	ctx.limits.maxOccurrences = 10;
+	// The texts differ, since identical texts are scored without probing
+	Document flatA(std::string(2000, 'a') + "\n"), flatB(std::string(2000, 'a') + "b\n");
+	PairResult r = comparePair(flatA, flatB, ctx);
+	CHECK(r.limited && r.limits.skippedKeys > 0 && r.limits.hit());
+
+	std::mt19937 rng(13);
+	std::vector<std::string> passages;
+	for (int i = 0; i < 40; ++i) passages.push_back(randomWords(rng, 12));
+	std::string a, b;
+	for (int i = 0; i < 40; ++i) {
+		a += passages[i] + "| " + std::to_string(i * 7919) + " |\n";
+		b += passages[39 - i] + "# " + std::to_string(i * 104729) + " #\n";
+	}
+	Document da(a), db(b);
+	ctx.limits = CompareLimits();
+	r = comparePair(da, db, ctx);
+	CHECK(!r.limited && r.spans.size() > 5);
+	ctx.limits.maxSpans = 5;
+	r = comparePair(da, db, ctx);
+	CHECK(r.limited && r.spans.size() <= 5 && r.limits.droppedSpans > 0);
+
+	SentenceMatcher matcher;
+	CompareLimits limits;
+	limits.maxSpans = 1;
+	matcher.setLimits(limits);
+	std::vector<Highlight> out;
+	Document s("First long sentence here. Second long sentence here.\n");
+	matcher.match(s, s, CancelToken::unlimited(), out);
+	CHECK(out.size() == 1 && matcher.limitsHit().droppedSpans == 1);
+}
+
+// After a reset the arena hands out the chunks it already holds instead of going to the heap
+static void testArenaReuse() {
+	Arena arena;
+	long long chunks = 0;
+	for (int round = 0; round < 3; ++round) {
+		{
+			std::pmr::vector<int> values(&arena);
+			for (int i = 0; i < 100000; ++i) values.push_back(i);
+			std::pmr::unordered_map<int, int> map(&arena);
+			for (int i = 0; i < 1000; ++i) map[i] = i;
+			CHECK(values[99999] == 99999 && map[999] == 999);
+		}
+		CHECK(arena.bytesUsed() > 0 && arena.bytesUsed() <= arena.bytesReserved());
+		if (round == 0) chunks = arena.chunkAllocations;
+		CHECK(chunks > 0 && arena.chunkAllocations == chunks);
+		arena.reset();
+		CHECK(arena.bytesUsed() == 0);
+	}
+}
+
+struct Test {
+	const char *name;
+	void (*run)();
+};
+
+const Test tests[] = {
+	{"lexer.pythonFloorDivision", testPythonFloorDivision},
+	{"lexer.languageOf", testLanguageOfPath},
+	{"lcs.bitParallel", testBitParallelLcs},
+	{"lcs.alignedRange", testAlignedRange},
+	{"jaccard.tokenShingleWidth", testTokenShingleWidth},
+	{"document.unreadableFiles", testUnreadableFiles},
+	{"pool.runsEachTaskOnce", testPoolRunsEachTaskOnce},
+	{"pool.stealsSkewedWork", testPoolStealsSkewedWork},
+	{"pool.determinism", testPoolDeterminism},
+	{"resultCache.eviction", testResultCacheEviction},
+	{"resultCache.diskBudget", testResultCacheDiskBudget},
+	{"documentCache.eviction", testDocumentCacheEviction},
+	{"spans.finalize", testFinalizeSpans},
+	{"sentences.match", testSentenceMatcher},
+	{"paragraphs.align", testParagraphAligner},
+	{"highlights.dedup", testHighlightDedup},
+	{"coverage.union", testCoverageUnion},
+	{"positions.crlf", testCrlfPositions},
+	{"cancel.budget", testCancellation},
+	{"limits.caps", testCompareLimits},
+	{"arena.reuse", testArenaReuse},
+};
+
+}  // namespace
+
+int main(int argc, char **argv) {
+	std::string only = argc > 1 ? argv[1] : "";
+	int run = 0;
+	for (const Test &test : tests) {
+		if (!only.empty() && only != test.name) continue;
+		int before = failures;
+		test.run();
+		++run;
+		std::printf("%s %s\n", failures == before ? "ok  " : "FAIL", test.name);
+	}
+	std::printf("%d tests, %d failed checks\n", run, failures);
+	return failures == 0 && run > 0 ? 0 : 1;
+}
@@ -1,11 +1,12 @@
 from fastapi import FastAPI, UploadFile, File, Form, HTTPException
 from fastapi.middleware.cors import CORSMiddleware
-from fastapi.responses import JSONResponse
+from fastapi.responses import JSONResponse, StreamingResponse
+import json
 import os
 import sys
 import uvicorn
 import secrets
-from typing import Optional, Dict
+from typing import Optional, Dict, List
 from pydantic import BaseModel
 
 
@@ -32,6 +33,7 @@ async def home():
         <li><code>POST /auth/signup</code></li>
         <li><code>POST /auth/login</code></li>
         <li><code>POST /check</code></li>
+        <li><code>POST /check/batch</code></li>
     </ul>
     <p>Made by Lakshya 🚀</p>
     """
@@ -120,6 +122,43 @@ async def check_endpoint(
 	return JSONResponse(content=result)
 
 
+@app.post("/check/batch")
+async def check_batch_endpoint(
+	mode: str = Form(default="local"),
+	fileA: Optional[UploadFile] = File(default=None),
+	filesB: List[UploadFile] = File(default=[]),
+	stream: bool = Form(default=False),
+):
+	"""
+	Compare fileA with every file in filesB in one checker run. With stream=true each result is sent
+	as one NDJSON line as soon as it is ready; "pair" is its index into filesB.
+	"""
+	mode = (mode or "local").lower().strip()
+	if mode != "local":
+		return JSONResponse(status_code=400, content={"error": "mode must be 'local'"})
+
+	if fileA is None or not filesB:
+		return JSONResponse(status_code=400, content={"error": "local mode requires fileA and at least one filesB"})
+
+	path_a = os.path.join(UPLOADS_DIR, fileA.filename)
+	with open(path_a, "wb") as f:
+		f.write(await fileA.read())
+	# One directory per position keeps targets that share a file name apart
+	paths_b: List[str] = []
+	for i, upload in enumerate(filesB):
+		target_dir = os.path.join(UPLOADS_DIR, f"batch_{i}")
+		os.makedirs(target_dir, exist_ok=True)
+		paths_b.append(os.path.join(target_dir, upload.filename))
+		with open(paths_b[-1], "wb") as f:
+			f.write(await upload.read())
+
+	if stream:
+		results = checker.iter_checks_batch(file_a_path=path_a, file_b_paths=paths_b, mode=mode)
+		return StreamingResponse((json.dumps(r) + "\n" for r in results), media_type="application/x-ndjson")
+	result = checker.run_checks_batch(file_a_path=path_a, file_b_paths=paths_b, mode=mode)
+	return JSONResponse(content=result)
+
+
 if __name__ == "__main__":
 	# Run with: python main.py  (from the Back-end directory)
 	uvicorn.run("main:app", host="0.0.0.0", port=8000, reload=True)